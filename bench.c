@@ -0,0 +1,326 @@
+// Headless benchmark for the search path: builds synthetic $PATH trees, scans them,
+// replays keystroke sequences and reports latency percentiles, syscalls and allocations.
+// Built without X11 by `make bench`, results are printed as one JSON object per line.
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "path_utils.h"
+#include "scan_utils.h"
+#include "history_utils.h"
+
+// A synthetic $PATH: dirs directories holding executables names in total.
+// symlink_percent of them are links into a shared store, like a nix profile.
+typedef struct {
+    const char *name;
+    int dirs;
+    int executables;
+    int symlink_percent;
+} BenchLayout;
+
+static const BenchLayout layouts[] = {
+    { "small", 10, 1000, 0 },
+    { "medium", 30, 20000, 20 },
+    { "nix", 60, 50000, 90 },
+    { "large", 100, 200000, 30 },
+};
+
+// Recorded keystroke sequences, '\b' is a backspace
+static const char *sequences[] = {
+    "git",
+    "gitconfig",
+    "python\b\b\b\bx",
+    "kde-s\b\b\bserver",
+    "firefox",
+    "t\bte\b\bts",
+    "gnome-control\b\b\b\b\b\b\b\btool",
+    "lib",
+};
+
+static const char *words[] = {
+    "git", "lib", "py", "python", "x", "gnome", "kde", "test", "run", "config",
+    "tool", "server", "fire", "fox", "ctl", "daemon", "helper", "nix", "qt", "gtk",
+};
+
+// Counters bumped by the --wrap'd allocator and syscall wrappers below
+static atomic_long allocations;
+static atomic_long syscalls;
+
+#define WRAP_ALLOC(ret, name, params, args) \
+    ret __real_##name params; \
+    ret __wrap_##name params { atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed); return __real_##name args; }
+#define WRAP_SYSCALL(ret, name, params, args) \
+    ret __real_##name params; \
+    ret __wrap_##name params { atomic_fetch_add_explicit(&syscalls, 1, memory_order_relaxed); return __real_##name args; }
+
+WRAP_ALLOC(void *, malloc, (size_t size), (size))
+WRAP_ALLOC(void *, calloc, (size_t count, size_t size), (count, size))
+WRAP_ALLOC(void *, realloc, (void *ptr, size_t size), (ptr, size))
+WRAP_SYSCALL(int, access, (const char *path, int mode), (path, mode))
+WRAP_SYSCALL(int, faccessat, (int dirfd, const char *path, int mode, int flags), (dirfd, path, mode, flags))
+WRAP_SYSCALL(int, stat, (const char *path, struct stat *st), (path, st))
+WRAP_SYSCALL(int, fstat, (int fd, struct stat *st), (fd, st))
+WRAP_SYSCALL(int, fstatat, (int dirfd, const char *path, struct stat *st, int flags), (dirfd, path, st, flags))
+WRAP_SYSCALL(DIR *, opendir, (const char *path), (path))
+WRAP_SYSCALL(struct dirent *, readdir, (DIR *dir), (dir))
+WRAP_SYSCALL(int, closedir, (DIR *dir), (dir))
+WRAP_SYSCALL(ssize_t, getdents64, (int fd, void *buf, size_t size), (fd, buf, size))
+WRAP_SYSCALL(int, close, (int fd), (fd))
+WRAP_SYSCALL(ssize_t, read, (int fd, void *buf, size_t size), (fd, buf, size))
+WRAP_SYSCALL(ssize_t, write, (int fd, const void *buf, size_t size), (fd, buf, size))
+WRAP_SYSCALL(void *, mmap, (void *addr, size_t size, int prot, int flags, int fd, off_t offset), (addr, size, prot, flags, fd, offset))
+WRAP_SYSCALL(int, munmap, (void *addr, size_t size), (addr, size))
+
+// open/openat are variadic, only the mode argument can follow
+int __real_open(const char *path, int flags, ...);
+int __wrap_open(const char *path, int flags, mode_t mode) {
+    atomic_fetch_add_explicit(&syscalls, 1, memory_order_relaxed);
+    return __real_open(path, flags, mode);
+}
+int __real_openat(int dirfd, const char *path, int flags, ...);
+int __wrap_openat(int dirfd, const char *path, int flags, mode_t mode) {
+    atomic_fetch_add_explicit(&syscalls, 1, memory_order_relaxed);
+    return __real_openat(dirfd, path, flags, mode);
+}
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void make_file(const char *path, mode_t mode) {
+    int fd = __real_open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (fd >= 0) {
+        __real_close(fd);
+    }
+}
+
+// Fill root with the layout's directories and return them joined as a $PATH value
+static char *make_tree(const char *root, const BenchLayout *layout) {
+    char path[PATH_MAX], target[PATH_MAX];
+    size_t path_env_size = (size_t)layout->dirs * 1100;
+    char *path_env = __real_calloc(1, path_env_size);
+
+    snprintf(path, sizeof(path), "%s/store", root);
+    mkdir(path, 0755);
+    for (int d = 0; d < layout->dirs; d++) {
+        snprintf(path, sizeof(path), "%s/dir%03d", root, d);
+        mkdir(path, 0755);
+        // A subdirectory and a non-executable file that the scanner has to skip
+        snprintf(path, sizeof(path), "%s/dir%03d/share", root, d);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s/dir%03d/README", root, d);
+        make_file(path, 0644);
+
+        size_t len = strlen(path_env);
+        snprintf(path_env + len, path_env_size - len, "%s%s/dir%03d", d ? ":" : "", root, d);
+    }
+
+    srand(42);
+    for (int i = 0; i < layout->executables; i++) {
+        // The first directory gets 40%, like /usr/bin, the rest share what is left
+        int d = (i % 10 < 4 || layout->dirs == 1) ? 0 : 1 + rand() % (layout->dirs - 1);
+        char name[128];
+        int len = snprintf(name, sizeof(name), "%s", words[rand() % 20]);
+        for (int w = rand() % 3; w > 0; w--) {
+            len += snprintf(name + len, sizeof(name) - len, "%s%s", (rand() % 2) ? "-" : "", words[rand() % 20]);
+        }
+        // Every 20th name repeats an earlier one, so the same executable shows up in several directories
+        snprintf(name + len, sizeof(name) - len, "%d", i % 20 == 19 ? i - 1 : i);
+
+        snprintf(path, sizeof(path), "%s/dir%03d/%s", root, d, name);
+        if (rand() % 100 < layout->symlink_percent) {
+            snprintf(target, sizeof(target), "%s/store/%s", root, name);
+            make_file(target, 0755);
+            if (symlink(target, path) != 0 && errno != EEXIST) {
+                make_file(path, 0755);
+            }
+        } else {
+            make_file(path, 0755);
+        }
+    }
+    return path_env;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int count, double p) {
+    int i = (int)(p * (count - 1) + 0.5);
+    return count > 0 ? sorted[i] : 0;
+}
+
+// Build the index like main.c does, with or without a warm on-disk cache
+static void bench_scan(FILE *out, const BenchLayout *layout, const char *phase, ExecIndex *index, PathScanner *scanner) {
+    long allocs = atomic_load(&allocations), calls = atomic_load(&syscalls);
+    double start = now_us();
+
+    scanner_start(scanner, index);
+    scanner_wait(scanner, index);
+
+    double elapsed = now_us() - start;
+    fprintf(out, "{\"bench\":\"scan\",\"layout\":\"%s\",\"phase\":\"%s\",\"dirs\":%d,\"executables\":%d,"
+                 "\"indexed\":%d,\"time_us\":%.1f,\"syscalls\":%ld,\"allocations\":%ld}\n",
+            layout->name, phase, layout->dirs, layout->executables, index->count, elapsed,
+            atomic_load(&syscalls) - calls, atomic_load(&allocations) - allocs);
+}
+
+// Replay every sequence once as a warm-up, then `rounds` more times while timing each keystroke
+static void bench_keys(FILE *out, const BenchLayout *layout, const ExecIndex *index, SearchState *state, int rounds) {
+    int keys_per_round = 0;
+    for (size_t s = 0; s < sizeof(sequences) / sizeof(sequences[0]); s++) {
+        keys_per_round += strlen(sequences[s]);
+    }
+    double *latencies = __real_malloc(sizeof(double) * keys_per_round * rounds);
+    long allocs = 0, calls = 0;
+    int samples = 0;
+
+    for (int round = 0; round <= rounds; round++) {
+        for (size_t s = 0; s < sizeof(sequences) / sizeof(sequences[0]); s++) {
+            char input[MAX_INPUT_LENGTH] = {0};
+            int input_len = 0;
+            ResultList result_list = {0};
+
+            for (const char *key = sequences[s]; *key; key++) {
+                if (*key == '\b') {
+                    if (input_len > 0) {
+                        input[--input_len] = '\0';
+                    }
+                } else if (input_len < MAX_INPUT_LENGTH - 1) {
+                    input[input_len++] = *key;
+                    input[input_len] = '\0';
+                }
+
+                long allocs_before = atomic_load(&allocations), calls_before = atomic_load(&syscalls);
+                double start = now_us();
+                search_binaries(index, state, input, &result_list);
+                double elapsed = now_us() - start;
+
+                if (round > 0) {
+                    latencies[samples++] = elapsed;
+                    allocs += atomic_load(&allocations) - allocs_before;
+                    calls += atomic_load(&syscalls) - calls_before;
+                }
+            }
+        }
+    }
+
+    qsort(latencies, samples, sizeof(double), compare_doubles);
+    fprintf(out, "{\"bench\":\"keystroke\",\"layout\":\"%s\",\"mode\":\"%s\",\"candidates\":%d,\"keystrokes\":%d,"
+                 "\"p50_us\":%.2f,\"p90_us\":%.2f,\"p99_us\":%.2f,\"max_us\":%.2f,"
+                 "\"syscalls_per_key\":%.3f,\"allocations_per_key\":%.3f}\n",
+            layout->name, state->fuzzy ? "fuzzy" : "prefix", index->count, samples,
+            percentile(latencies, samples, 0.50), percentile(latencies, samples, 0.90),
+            percentile(latencies, samples, 0.99), samples > 0 ? latencies[samples - 1] : 0,
+            samples > 0 ? (double)calls / samples : 0, samples > 0 ? (double)allocs / samples : 0);
+    free(latencies);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [-l layout] [-r rounds] [-o file]\n", argv0);
+    fprintf(stderr, "Layouts:");
+    for (size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        fprintf(stderr, " %s (%d dirs, %d executables)", layouts[i].name, layouts[i].dirs, layouts[i].executables);
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *only = NULL;
+    const char *output = NULL;
+    int rounds = 20;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:r:o:h")) != -1) {
+        switch (opt) {
+        case 'l': only = optarg; break;
+        case 'r': rounds = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+        case 'o': output = optarg; break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    FILE *out = output ? fopen(output, "w") : stdout;
+    if (!out) {
+        perror("fopen failed");
+        return 1;
+    }
+
+    for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+        const BenchLayout *layout = &layouts[l];
+        if (only && strcmp(only, layout->name) != 0) {
+            continue;
+        }
+
+        char root[] = "/tmp/simplesearch-bench-XXXXXX";
+        if (!mkdtemp(root)) {
+            perror("mkdtemp failed");
+            return 1;
+        }
+        fprintf(stderr, "Generating %s layout in %s...\n", layout->name, root);
+
+        char tree[1100], cache[1100];
+        snprintf(tree, sizeof(tree), "%s/tree", root);
+        snprintf(cache, sizeof(cache), "%s/cache", root);
+        mkdir(tree, 0755);
+        mkdir(cache, 0755);
+        char *path_env = make_tree(tree, layout);
+        setenv("PATH", path_env, 1);
+        setenv("XDG_CACHE_HOME", cache, 1);
+
+        ExecIndex index = {0};
+        PathScanner scanner;
+        bench_scan(out, layout, "cold", &index, &scanner);
+        scanner_free(&scanner);
+        index_free(&index);
+        bench_scan(out, layout, "cached", &index, &scanner);
+        scanner_free(&scanner);
+
+        // Give a few entries some launch history so the ranking path is exercised too
+        History history;
+        SearchState state = {0};
+        history_open(&history);
+        for (int i = 0; i < index.count; i += index.count / 50 + 1) {
+            history_record(&history, index_name(&index, index.order[i]));
+        }
+        state.boost = history_rank(&history, &index);
+        state.boost_count = state.boost ? index.id_count : 0;
+
+        for (state.fuzzy = 0; state.fuzzy <= 1; state.fuzzy++) {
+            search_reset(&state);
+            bench_keys(out, layout, &index, &state, rounds);
+        }
+        fflush(out);
+
+        search_free(&state);
+        history_close(&history);
+        index_free(&index);
+        free(path_env);
+        nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,303 @@
+#include "cache_utils.h"
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Build the path of one of our files under $XDG_CACHE_HOME (or ~/.cache), creating the directory if asked
+int cache_file_path(char *buf, size_t size, const char *name, int create_dir) {
+    const char *base = getenv("XDG_CACHE_HOME");
+    int len;
+
+    if (base && base[0] == '/') {
+        len = snprintf(buf, size, "%s/%s", base, CACHE_DIR_NAME);
+    } else {
+        const char *home = getenv("HOME");
+        if (!home) {
+            return -1;
+        }
+        len = snprintf(buf, size, "%s/.cache/%s", home, CACHE_DIR_NAME);
+    }
+    if (len < 0 || (size_t)len >= size) {
+        return -1;
+    }
+
+    if (create_dir) {
+        // Create ~/.cache first if it doesn't exist yet
+        char *slash = strrchr(buf, '/');
+        *slash = '\0';
+        mkdir(buf, 0700);
+        *slash = '/';
+        if (mkdir(buf, 0700) != 0 && errno != EEXIST) {
+            return -1;
+        }
+    }
+
+    len = snprintf(buf + len, size - len, "/%s", name) + len;
+    return (size_t)len < size ? 0 : -1;
+}
+
+// Byte positions of the index arrays, in the order cache_write puts them
+typedef struct {
+    size_t masks, offsets, order, lookup, name_lens, dir_of, strings, end;
+} CacheSections;
+
+static void cache_sections(const CacheHeader *header, CacheSections *at) {
+    at->masks = header->index_offset;
+    at->offsets = at->masks + sizeof(uint64_t) * header->id_count;
+    at->order = at->offsets + sizeof(uint32_t) * header->id_count;
+    at->lookup = at->order + sizeof(int) * header->count;
+    at->name_lens = at->lookup + sizeof(int) * header->lookup_size;
+    at->dir_of = at->name_lens + sizeof(uint16_t) * header->id_count;
+    at->strings = at->dir_of + sizeof(uint16_t) * header->id_count;
+    at->end = at->strings + header->strings_len + INDEX_STRING_PAD;
+}
+
+// Check that every offset, id and name in the mapped index stays inside it, so it can be used as is
+static int cache_valid(const void *map, size_t size) {
+    const CacheHeader *header = map;
+    const char *bytes = map;
+    CacheSections at;
+
+    size_t table_end = sizeof(CacheHeader) + (size_t)header->dir_count * sizeof(CacheDir);
+    if (header->magic != CACHE_MAGIC || header->version != CACHE_VERSION || header->dir_count >= INDEX_REMOVED ||
+        table_end > header->index_offset || header->index_offset % 8 != 0 || header->count > header->id_count) {
+        return 0;
+    }
+    cache_sections(header, &at);
+    if (at.end != size || (header->lookup_size != 0 && ((header->lookup_size & (header->lookup_size - 1)) != 0 ||
+                                                        header->lookup_size / 2 < header->id_count))) {
+        return 0;
+    }
+
+    const CacheDir *dirs = (const CacheDir *)(header + 1);
+    for (uint32_t i = 0; i < header->dir_count; i++) {
+        if (dirs[i].path_offset < table_end || dirs[i].path_offset >= header->index_offset) {
+            return 0;
+        }
+    }
+    if (header->dir_count > 0 && bytes[header->index_offset - 1] != '\0') {
+        return 0;
+    }
+
+    const uint32_t *offsets = (const uint32_t *)(bytes + at.offsets);
+    const uint16_t *name_lens = (const uint16_t *)(bytes + at.name_lens);
+    const uint16_t *dir_of = (const uint16_t *)(bytes + at.dir_of);
+    const char *strings = bytes + at.strings;
+    for (uint32_t id = 0; id < header->id_count; id++) {
+        if ((size_t)offsets[id] + name_lens[id] >= header->strings_len || strings[offsets[id] + name_lens[id]] != '\0' ||
+            dir_of[id] >= header->dir_count) {
+            return 0;
+        }
+    }
+    const int *order = (const int *)(bytes + at.order);
+    for (uint32_t i = 0; i < header->count; i++) {
+        if (order[i] < 0 || (uint32_t)order[i] >= header->id_count) {
+            return 0;
+        }
+    }
+    // Probing stops at an empty slot, there has to be one
+    const int *lookup = (const int *)(bytes + at.lookup);
+    uint32_t empty = 0;
+    for (uint32_t i = 0; i < header->lookup_size; i++) {
+        if (lookup[i] < 0 || (uint32_t)lookup[i] > header->id_count) {
+            return 0;
+        }
+        empty += lookup[i] == 0;
+    }
+    if (header->lookup_size != 0 && empty == 0) {
+        return 0;
+    }
+    // The matcher reads whole vectors past the last name
+    for (size_t i = header->strings_len; i < header->strings_len + INDEX_STRING_PAD; i++) {
+        if (strings[i] != '\0') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Map the cache file and check that it can be used in place
+int cache_open(PathCache *cache) {
+    char path[1024];
+    struct stat st;
+
+    memset(cache, 0, sizeof(*cache));
+    if (cache_file_path(path, sizeof(path), CACHE_FILE_NAME, 0) != 0) {
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(CacheHeader)) {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    if (!cache_valid(map, st.st_size)) {
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    cache->map = map;
+    cache->size = st.st_size;
+    cache->header = map;
+    cache->dirs = (const CacheDir *)(cache->header + 1);
+    return 0;
+}
+
+// Entry of the cached directory with the given path, -1 if there is none. Looks at entry hint first,
+// as $PATH rarely changes between runs.
+int cache_find_dir(const PathCache *cache, const char *path, int hint) {
+    if (!cache->map) {
+        return -1;
+    }
+    if (hint >= 0 && (uint32_t)hint < cache->header->dir_count &&
+        strcmp((const char *)cache->map + cache->dirs[hint].path_offset, path) == 0) {
+        return hint;
+    }
+    for (uint32_t i = 0; i < cache->header->dir_count; i++) {
+        if (strcmp((const char *)cache->map + cache->dirs[i].path_offset, path) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// Point view at the cached index, read-only and only until cache_close. It has no dirs, dir_of refers to cache->dirs.
+void cache_view_index(const PathCache *cache, ExecIndex *view) {
+    const CacheHeader *header = cache->header;
+    char *bytes = cache->map;
+    CacheSections at;
+
+    cache_sections(header, &at);
+    memset(view, 0, sizeof(*view));
+    view->strings = bytes + at.strings;
+    view->strings_len = header->strings_len;
+    view->strings_cap = header->strings_len + INDEX_STRING_PAD;
+    view->offsets = (uint32_t *)(bytes + at.offsets);
+    view->name_lens = (uint16_t *)(bytes + at.name_lens);
+    view->dir_of = (uint16_t *)(bytes + at.dir_of);
+    view->char_masks = (uint64_t *)(bytes + at.masks);
+    view->order = (int *)(bytes + at.order);
+    view->count = header->count;
+    view->sorted = header->count;
+    view->id_count = header->id_count;
+    view->capacity = header->id_count;
+    view->lookup = header->lookup_size ? (int *)(bytes + at.lookup) : NULL;
+    view->lookup_size = header->lookup_size;
+    view->dir_count = header->dir_count;
+}
+
+// Use the cached index as index, for when every one of its directories is unchanged and in the same place.
+// The index takes the mapping over, cache_close leaves it alone.
+void cache_adopt_index(PathCache *cache, ExecIndex *index) {
+    IndexDir *dirs = index->dirs;
+    int dir_count = index->dir_count;
+
+    cache_view_index(cache, index);
+    index->dirs = dirs;
+    index->dir_count = dir_count;
+    for (int i = 0; i < dir_count; i++) {
+        dirs[i].name_count = cache->dirs[i].name_count;
+    }
+    index->map = cache->map;
+    index->map_size = cache->size;
+    memset(cache, 0, sizeof(*cache));
+}
+
+void cache_close(PathCache *cache) {
+    if (cache->map) {
+        munmap(cache->map, cache->size);
+    }
+    memset(cache, 0, sizeof(*cache));
+}
+
+// Write a finalized index back to disk, arrays and all, so the next start can map it and use it as is.
+// The file is written under a temporary name and renamed so readers never see half of it.
+int cache_write(const ExecIndex *index) {
+    static const char zeros[INDEX_STRING_PAD];
+    char path[1024], tmp_path[1100];
+
+    // Only a finalized index has its ids and strings in the order the layout expects
+    if (index->scattered || index->sorted != index->count) {
+        return -1;
+    }
+    if (cache_file_path(path, sizeof(path), CACHE_FILE_NAME, 1) != 0) {
+        return -1;
+    }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) {
+        return -1;
+    }
+
+    // Directory table, the paths follow it and the arrays follow the paths
+    size_t table_end = sizeof(CacheHeader) + index->dir_count * sizeof(CacheDir);
+    size_t paths_end = table_end;
+    for (int i = 0; i < index->dir_count; i++) {
+        paths_end += strlen(index->dirs[i].path) + 1;
+    }
+    CacheHeader header = {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_VERSION,
+        .dir_count = (uint32_t)index->dir_count,
+        .id_count = (uint32_t)index->id_count,
+        .count = (uint32_t)index->count,
+        .lookup_size = index->lookup ? (uint32_t)index->lookup_size : 0,
+        .strings_len = (uint32_t)index->strings_len,
+        .index_offset = (uint32_t)((paths_end + 7) & ~(size_t)7),
+    };
+    fwrite(&header, sizeof(header), 1, file);
+
+    uint32_t path_offset = table_end;
+    for (int i = 0; i < index->dir_count; i++) {
+        const IndexDir *dir = &index->dirs[i];
+        CacheDir entry = {
+            .mtime_sec = dir->mtime_sec,
+            .mtime_nsec = dir->mtime_nsec,
+            .path_offset = path_offset,
+            .name_count = dir->name_count,
+        };
+        fwrite(&entry, sizeof(entry), 1, file);
+        path_offset += strlen(dir->path) + 1;
+    }
+    for (int i = 0; i < index->dir_count; i++) {
+        fwrite(index->dirs[i].path, strlen(index->dirs[i].path) + 1, 1, file);
+    }
+    fwrite(zeros, header.index_offset - paths_end, 1, file);
+
+    fwrite(index->char_masks, sizeof(uint64_t), index->id_count, file);
+    fwrite(index->offsets, sizeof(uint32_t), index->id_count, file);
+    fwrite(index->order, sizeof(int), index->count, file);
+    if (header.lookup_size) {
+        fwrite(index->lookup, sizeof(int), header.lookup_size, file);
+    }
+    fwrite(index->name_lens, sizeof(uint16_t), index->id_count, file);
+    fwrite(index->dir_of, sizeof(uint16_t), index->id_count, file);
+    if (index->strings_len > 0) {
+        fwrite(index->strings, 1, index->strings_len, file);
+    }
+    fwrite(zeros, INDEX_STRING_PAD, 1, file);
+
+    int failed = ferror(file);
+    if (fclose(file) != 0 || failed || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
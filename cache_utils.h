@@ -0,0 +1,48 @@
+#ifndef CACHE_UTILS_H
+#define CACHE_UTILS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "index_utils.h"
+
+#define CACHE_MAGIC 0x58495353      // "SSIX"
+#define CACHE_VERSION 2
+
+// On-disk layout: header, one CacheDir per $PATH directory, the directory paths, then the arrays of a
+// finalized ExecIndex: char masks, offsets, order, lookup table, name lengths, dirs and the string table
+// with its zero padding, each aligned for its type. The arrays are used in place from the mapping.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t dir_count;
+    uint32_t id_count;
+    uint32_t count;         // Entries in order
+    uint32_t lookup_size;
+    uint32_t strings_len;   // INDEX_STRING_PAD zero bytes follow the names
+    uint32_t index_offset;  // Start of the arrays, 8-byte aligned
+} CacheHeader;
+
+typedef struct {
+    int64_t mtime_sec;      // -1 for a directory that was missing
+    int64_t mtime_nsec;
+    uint32_t path_offset;
+    uint32_t name_count;
+} CacheDir;
+
+typedef struct {
+    void *map;
+    size_t size;
+    const CacheHeader *header;
+    const CacheDir *dirs;
+} PathCache;
+
+int cache_file_path(char *buf, size_t size, const char *name, int create_dir);
+int cache_open(PathCache *cache);
+int cache_find_dir(const PathCache *cache, const char *path, int hint);
+void cache_view_index(const PathCache *cache, ExecIndex *view);
+void cache_adopt_index(PathCache *cache, ExecIndex *index);
+void cache_close(PathCache *cache);
+int cache_write(const ExecIndex *index);
+
+#endif
@@ -0,0 +1,325 @@
+// Headless checks for result paging: every page search_page, lines_page and complete_page hand out is
+// compared with a brute-force ranking of the same candidates, for prefix and fuzzy queries, with and
+// without launch history. Built without X11 by `make check`, exits non-zero if anything differs.
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "complete_utils.h"
+#include "lines_utils.h"
+#include "path_utils.h"
+
+#define CHECK_NAMES 50000           // Index entries, enough for several thousand matches per query
+#define CHECK_LINES 300000          // Stdin lines, enough to need more than one search block
+#define CHECK_FILES 300             // Directory entries to complete, several pages of them
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s: ", __FILE__, __LINE__, #cond); \
+        fprintf(stderr, __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+        failures++; \
+        return; \
+    } \
+} while (0)
+
+// Rank every index entry against query the slow way, in the order search_binaries promises
+static int rank_index(const ExecIndex *index, const SearchState *state, const char *query, int *ranked) {
+    int query_len = strlen(query), count = 0;
+    int fuzzy = state->fuzzy && query_len > 0;
+    ScoredMatch *matches = malloc(sizeof(ScoredMatch) * (index->count > 0 ? index->count : 1));
+
+    for (int i = 0; matches && i < index->count; i++) {
+        int id = index->order[i];
+        const char *name = index_name(index, id);
+        int score = 0;
+        // The exact match is left out, the input already shows it
+        if (strcmp(name, query) == 0) {
+            continue;
+        }
+        if (fuzzy) {
+            score = fuzzy_score(name, index_name_len(index, id), query, query_len);
+            if (score < 0) {
+                continue;
+            }
+        } else if (strncmp(name, query, query_len) != 0) {
+            continue;
+        }
+        if (state->boost && id < state->boost_count) {
+            score += state->boost[id];
+        }
+        matches[count++] = (ScoredMatch){ id, score, i };
+    }
+    match_rank(matches, count, 0, count);
+    for (int i = 0; i < count; i++) {
+        ranked[i] = matches[i].id;
+    }
+    free(matches);
+    return count;
+}
+
+// Search query, then walk its pages at uneven offsets and past the end
+static void check_index_query(const ExecIndex *index, SearchState *state, const char *query, int *ranked) {
+    ResultList result_list;
+
+    CHECK(search_binaries(index, state, query, &result_list) >= 0, "\"%s\" was not searched", query);
+    int total = rank_index(index, state, query, ranked);
+    CHECK(result_list.total == total, "\"%s\" total %d, expected %d", query, result_list.total, total);
+    for (int i = 0; i < result_list.count; i++) {
+        CHECK(result_list.ids[i] == ranked[i], "\"%s\" first page differs at %d", query, i);
+    }
+
+    for (int offset = 0; offset < total; offset += 7 + offset / 3) {
+        search_page(index, state, offset, &result_list);
+        int count = total - offset < MAX_RESULTS ? total - offset : MAX_RESULTS;
+        CHECK(result_list.offset == offset && result_list.total == total && result_list.count == count,
+              "\"%s\" page at %d holds %d from %d", query, offset, result_list.count, result_list.offset);
+        for (int i = 0; i < count; i++) {
+            CHECK(result_list.ids[i] == ranked[offset + i], "\"%s\" page at %d differs at %d", query, offset, i);
+        }
+    }
+
+    // Past the end the last result is shown on its own
+    search_page(index, state, total + 5, &result_list);
+    CHECK(total == 0 || (result_list.offset == total - 1 && result_list.count == 1),
+          "\"%s\" page past the end starts at %d", query, result_list.offset);
+}
+
+static void check_index(void) {
+    static const char *queries[] = { "", "b", "b1", "b12", "b12-", "b1", "b9f", "zz" };
+    ExecIndex index = {0};
+    char name[64];
+
+    for (int i = 0; i < CHECK_NAMES; i++) {
+        snprintf(name, sizeof(name), "b%d-%x", i % 7000, i * 2654435761u);
+        index_add(&index, name, 0);
+    }
+    index_add(&index, "b1", 0);
+    index_finalize(&index);
+
+    int *ranked = malloc(sizeof(int) * index.count);
+    int *boost = calloc(index.id_count, sizeof(int));
+    if (!ranked || !boost) {
+        perror("malloc failed");
+        exit(1);
+    }
+    for (int id = 0; id < index.id_count; id++) {
+        boost[id] = id % 97 == 0 ? id % 13 : 0;
+    }
+
+    for (int with_boost = 0; with_boost <= 1; with_boost++) {
+        for (int fuzzy = 0; fuzzy <= 1; fuzzy++) {
+            SearchState state = { .fuzzy = fuzzy };
+            state.boost = with_boost ? boost : NULL;
+            state.boost_count = with_boost ? index.id_count : 0;
+            for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); q++) {
+                check_index_query(&index, &state, queries[q], ranked);
+            }
+            search_free(&state);
+        }
+    }
+    printf("index paging checked\n");
+
+    free(boost);
+    free(ranked);
+    index_free(&index);
+}
+
+// Rank every line against query the slow way: prefix matches before substring matches, or by fuzzy score
+static int rank_lines(const LineInput *lines, int fuzzy, const char *query, ScoredMatch *matches) {
+    int query_len = strlen(query), count = 0;
+
+    for (int line = 0; line < lines->count; line++) {
+        const char *text = lines_text(lines, line);
+        int len = lines_len(lines, line), score = 0;
+        if (query_len == 0) {
+            score = 0;
+        } else if (fuzzy) {
+            if (char_mask(query) & ~lines->char_masks[line]) {
+                continue;
+            }
+            score = fuzzy_score(text, len, query, query_len);
+            if (score < 0) {
+                continue;
+            }
+        } else if (len < query_len) {
+            continue;
+        } else if (memcmp(text, query, query_len) == 0) {
+            score = len == query_len ? 2 : 1;
+        } else if (!memmem(text + 1, len - 1, query, query_len)) {
+            continue;
+        }
+        matches[count++] = (ScoredMatch){ line, score, line };
+    }
+    if (query_len > 0) {
+        match_rank(matches, count, 0, count);
+    }
+    return count;
+}
+
+static void check_lines_query(LineInput *lines, int fuzzy, const char *query, ScoredMatch *ranked) {
+    ResultList result_list;
+
+    CHECK(lines_search(lines, fuzzy, query, &result_list, NULL) >= 0, "\"%s\" was not searched", query);
+    int total = rank_lines(lines, fuzzy, query, ranked);
+    CHECK(result_list.total == total, "\"%s\" total %d, expected %d", query, result_list.total, total);
+    for (int i = 0; i < result_list.count; i++) {
+        CHECK(result_list.ids[i] == ranked[i].id, "\"%s\" first page differs at %d", query, i);
+    }
+
+    for (int offset = 0; offset < total; offset += 1 + offset / 2) {
+        lines_page(lines, offset, &result_list);
+        CHECK(result_list.offset == offset, "\"%s\" page at %d starts at %d", query, offset, result_list.offset);
+        for (int i = 0; i < result_list.count; i++) {
+            int line = result_list.ids[i];
+            CHECK(line == ranked[offset + i].id, "\"%s\" page at %d differs at %d", query, offset, i);
+            CHECK(strncmp(result_list.items[i], lines_text(lines, line), lines_len(lines, line)) == 0,
+                  "\"%s\" page at %d shows the wrong text at %d", query, offset, i);
+        }
+    }
+}
+
+static void check_lines(const char *root) {
+    static const char *queries[] = { "", "e-9", "e-99", "9a", "e-99" };
+    char path[PATH_MAX];
+    LineInput lines;
+
+    snprintf(path, sizeof(path), "%s/lines", root);
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        perror("fopen failed");
+        exit(1);
+    }
+    for (int i = 0; i < CHECK_LINES; i++) {
+        fprintf(file, "line-%d-abc-%x\n", i, i * 2654435761u);
+    }
+    fclose(file);
+
+    if (lines_open(&lines, open(path, O_RDONLY)) != 0) {
+        perror("lines_open failed");
+        exit(1);
+    }
+    while (!lines.eof) {
+        lines_read(&lines);
+    }
+
+    ScoredMatch *ranked = malloc(sizeof(ScoredMatch) * lines.count);
+    if (!ranked) {
+        perror("malloc failed");
+        exit(1);
+    }
+    for (int fuzzy = 0; fuzzy <= 1; fuzzy++) {
+        for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); q++) {
+            check_lines_query(&lines, fuzzy, queries[q], ranked);
+        }
+    }
+    printf("lines paging checked\n");
+
+    free(ranked);
+    lines_close(&lines);
+}
+
+// Complete input once the worker has listed its directory, giving up after a few seconds.
+// Every input checked has completions, so none yet means the listing is still on its way.
+static int complete_listed(PathCompleter *completer, const char *input, ResultList *result_list) {
+    if (complete_path(completer, input, result_list) > 0) {
+        return result_list->count;
+    }
+    for (int waited = 0; waited < 5000; waited++) {
+        if (completer_collect(completer) > 0) {
+            break;
+        }
+        usleep(1000);
+    }
+    return complete_path(completer, input, result_list);
+}
+
+static void check_complete_query(PathCompleter *completer, const char *input, int total, const char *first) {
+    ResultList result_list;
+
+    complete_listed(completer, input, &result_list);
+    CHECK(result_list.total == total, "\"%s\" total %d, expected %d", input, result_list.total, total);
+    CHECK(total == 0 || strcmp(result_list.items[0], first) == 0, "\"%s\" starts with %s", input, result_list.items[0]);
+
+    // Entries are listed in name order, so page by page the names keep increasing
+    const char *last = NULL;
+    int seen = 0;
+    for (int offset = 0; offset < total; offset += MAX_RESULTS) {
+        complete_page(completer, input, offset, &result_list);
+        CHECK(result_list.offset == offset && result_list.total == total, "\"%s\" page at %d starts at %d",
+              input, offset, result_list.offset);
+        for (int i = 0; i < result_list.count; i++) {
+            CHECK(!last || strcmp(last, result_list.items[i]) < 0, "\"%s\" page at %d out of order at %d", input, offset, i);
+            last = result_list.items[i];
+            seen++;
+        }
+    }
+    CHECK(seen == total, "\"%s\" pages held %d of %d", input, seen, total);
+}
+
+static void check_complete(const char *root) {
+    char path[PATH_MAX], input[PATH_MAX + 8];
+    PathCompleter completer;
+
+    snprintf(path, sizeof(path), "%s/files", root);
+    mkdir(path, 0755);
+    for (int i = 0; i < CHECK_FILES; i++) {
+        snprintf(path, sizeof(path), "%s/files/%s%03d", root, i % 3 == 0 ? "g" : "f", i);
+        close(open(path, O_WRONLY | O_CREAT, 0644));
+    }
+    // Sorting puts the hidden entry between these and the rest, so a page has to step over it
+    snprintf(path, sizeof(path), "%s/files/+plus", root);
+    close(open(path, O_WRONLY | O_CREAT, 0644));
+    snprintf(path, sizeof(path), "%s/files/.hidden", root);
+    close(open(path, O_WRONLY | O_CREAT, 0644));
+
+    if (completer_init(&completer) != 0) {
+        perror("completer_init failed");
+        exit(1);
+    }
+    snprintf(input, sizeof(input), "ls %s/files/", root);
+    check_complete_query(&completer, input, CHECK_FILES + 1, "+plus");
+    snprintf(input, sizeof(input), "ls %s/files/f", root);
+    check_complete_query(&completer, input, CHECK_FILES - CHECK_FILES / 3, "f001");
+    snprintf(input, sizeof(input), "ls %s/files/g", root);
+    check_complete_query(&completer, input, CHECK_FILES / 3, "g000");
+    snprintf(input, sizeof(input), "ls %s/files/.", root);
+    check_complete_query(&completer, input, 1, ".hidden");
+    printf("completion paging checked\n");
+
+    completer_free(&completer);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+int main(void) {
+    char root[] = "/tmp/simplesearch-check-XXXXXX";
+    if (!mkdtemp(root)) {
+        perror("mkdtemp failed");
+        return 1;
+    }
+
+    check_index();
+    check_lines(root);
+    check_complete(root);
+
+    nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
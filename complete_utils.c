@@ -0,0 +1,434 @@
+#include "complete_utils.h"
+#include "launch_utils.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static void listing_free(CompleteListing *listing) {
+    if (listing) {
+        free(listing->path);
+        free(listing->names);
+        free(listing->entries);
+        free(listing);
+    }
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// Read and sort one directory, on the worker thread
+static CompleteListing *listing_load(const char *path) {
+    CompleteListing *listing = calloc(1, sizeof(CompleteListing));
+    size_t len = 0, cap = 0;
+
+    if (!listing || !(listing->path = strdup(path))) {
+        listing_free(listing);
+        return NULL;
+    }
+
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        int is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = fstatat(dirfd(dir), entry->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+        }
+
+        size_t name_len = strlen(entry->d_name);
+        if (len + name_len + 2 > cap) {
+            size_t new_cap = cap ? cap * 2 : 4096;
+            while (new_cap < len + name_len + 2) {
+                new_cap *= 2;
+            }
+            char *names = realloc(listing->names, new_cap);
+            if (!names) {
+                break;
+            }
+            listing->names = names;
+            cap = new_cap;
+        }
+        memcpy(listing->names + len, entry->d_name, name_len);
+        len += name_len;
+        if (is_dir) {
+            listing->names[len++] = '/';
+        }
+        listing->names[len++] = '\0';
+        listing->count++;
+    }
+    if (dir) {
+        closedir(dir);
+    }
+
+    // Pointers only now that names has stopped moving
+    listing->entries = malloc(sizeof(char *) * (listing->count > 0 ? listing->count : 1));
+    if (!listing->entries) {
+        listing->count = 0;
+    }
+    size_t pos = 0;
+    for (int i = 0; i < listing->count; i++) {
+        listing->entries[i] = listing->names + pos;
+        pos += strlen(listing->names + pos) + 1;
+    }
+    qsort(listing->entries, listing->count, sizeof(char *), compare_entries);
+    listing->loaded_at = monotonic_seconds();
+    return listing;
+}
+
+// Worker loop: read whichever directory was asked for last and hand the listing back
+static void *complete_worker(void *arg) {
+    PathCompleter *completer = arg;
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&completer->lock);
+    for (;;) {
+        while (!completer->quit && completer->request[0] == '\0') {
+            pthread_cond_wait(&completer->wake, &completer->lock);
+        }
+        if (completer->quit) {
+            break;
+        }
+        memcpy(completer->loading, completer->request, sizeof(completer->loading));
+        completer->request[0] = '\0';
+        pthread_mutex_unlock(&completer->lock);
+
+        CompleteListing *listing = listing_load(completer->loading);
+
+        pthread_mutex_lock(&completer->lock);
+        completer->loading[0] = '\0';
+        if (listing) {
+            listing->next = completer->finished;
+            completer->finished = listing;
+            if (write(completer->wake_fd, &one, sizeof(one)) < 0) {
+                // The listing is still picked up by the next completer_collect
+            }
+        }
+    }
+    pthread_mutex_unlock(&completer->lock);
+    return NULL;
+}
+
+int completer_init(PathCompleter *completer) {
+    memset(completer, 0, sizeof(*completer));
+    pthread_mutex_init(&completer->lock, NULL);
+    pthread_cond_init(&completer->wake, NULL);
+    completer->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    return completer->wake_fd >= 0 ? 0 : -1;
+}
+
+// Ask the worker for a directory, starting it the first time
+static void completer_request(PathCompleter *completer, const char *path) {
+    pthread_mutex_lock(&completer->lock);
+    if (strcmp(completer->loading, path) == 0) {
+        // Already on its way, and whatever was queued before is no longer wanted
+        completer->request[0] = '\0';
+    } else {
+        snprintf(completer->request, sizeof(completer->request), "%s", path);
+        pthread_cond_signal(&completer->wake);
+    }
+    pthread_mutex_unlock(&completer->lock);
+
+    if (!completer->started) {
+        completer->started = pthread_create(&completer->thread, NULL, complete_worker, completer) == 0;
+    }
+}
+
+// Slot of the cached listing for path, or of the one to replace (free or least recently used)
+static int cache_slot(PathCompleter *completer, const char *path, int *found) {
+    int victim = 0;
+
+    for (int i = 0; i < COMPLETE_CACHE_DIRS; i++) {
+        CompleteListing *listing = completer->cache[i];
+        if (listing && strcmp(listing->path, path) == 0) {
+            *found = 1;
+            return i;
+        }
+        if (!listing) {
+            victim = i;
+        } else if (completer->cache[victim] && listing->last_used < completer->cache[victim]->last_used) {
+            victim = i;
+        }
+    }
+    *found = 0;
+    return victim;
+}
+
+// Move listings the worker finished into the cache. Returns how many arrived.
+int completer_collect(PathCompleter *completer) {
+    uint64_t wakeups;
+
+    if (read(completer->wake_fd, &wakeups, sizeof(wakeups)) < 0) {
+        // Nothing signalled, the list below is checked anyway
+    }
+    pthread_mutex_lock(&completer->lock);
+    CompleteListing *finished = completer->finished;
+    completer->finished = NULL;
+    pthread_mutex_unlock(&completer->lock);
+
+    int arrived = 0;
+    while (finished) {
+        CompleteListing *listing = finished;
+        finished = listing->next;
+        listing->next = NULL;
+        listing->serial = ++completer->serial;
+
+        int found;
+        int slot = cache_slot(completer, listing->path, &found);
+        listing->last_used = found ? completer->cache[slot]->last_used : ++completer->clock;
+        listing_free(completer->cache[slot]);
+        completer->cache[slot] = listing;
+        arrived++;
+    }
+    return arrived;
+}
+
+// Start of the last word of input, which starts after the last blank that is neither escaped nor quoted.
+// *quote_out gets the quote still open at the end of input, 0 if none; it may be NULL.
+static const char *last_word(const char *input, char *quote_out) {
+    const char *word = input;
+    char quote = 0;
+
+    for (const char *p = input; *p; p++) {
+        if (quote == '"' && *p == '\\' && p[1]) {
+            p++;
+        } else if (quote) {
+            quote = *p == quote ? 0 : quote;
+        } else if (*p == '\\' && p[1]) {
+            p++;
+        } else if (*p == '\'' || *p == '"') {
+            quote = *p;
+        } else if (*p == ' ' || *p == '\t') {
+            word = p + 1;
+        }
+    }
+    if (quote_out) {
+        *quote_out = quote;
+    }
+    return word;
+}
+
+// The word as the shell will pass it on, with backslashes and quotes taken away. Returns -1 if it doesn't fit.
+static int unescape_word(char *buf, size_t size, const char *word) {
+    size_t len = 0;
+    char quote = 0;
+
+    for (const char *p = word; *p; p++) {
+        if (quote && *p == quote) {
+            quote = 0;
+            continue;
+        }
+        if (!quote && (*p == '\'' || *p == '"')) {
+            quote = *p;
+            continue;
+        }
+        if (*p == '\\' && p[1] && (!quote || (quote == '"' && strchr("$`\"\\", p[1])))) {
+            p++;
+        }
+        if (len + 1 >= size) {
+            return -1;
+        }
+        buf[len++] = *p;
+    }
+    buf[len] = '\0';
+    return 0;
+}
+
+// Directory a partial path argument lives in: "" is the working directory, a leading ~/ is $HOME
+static int expand_dir(char *buf, size_t size, const char *word, size_t dir_len) {
+    const char *home = getenv("HOME");
+    int len;
+
+    if (dir_len == 0) {
+        len = snprintf(buf, size, ".");
+    } else if (word[0] == '~' && word[1] == '/' && home) {
+        len = snprintf(buf, size, "%s%.*s", home, (int)dir_len - 1, word + 1);
+    } else {
+        len = snprintf(buf, size, "%.*s", (int)dir_len, word);
+    }
+    if (len < 0 || (size_t)len >= size) {
+        return -1;
+    }
+    // Keep "/" itself, drop the separator after anything else so "dir" and "dir/" share a listing
+    if (len > 1 && buf[len - 1] == '/') {
+        buf[len - 1] = '\0';
+    }
+    return 0;
+}
+
+// First entry that starts with prefix, or with upper set the first after every such entry
+static int listing_bound(const CompleteListing *listing, const char *prefix, size_t len, int upper) {
+    int lo = 0, hi = listing->count;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        int cmp = strncmp(listing->entries[mid], prefix, len);
+        if (cmp < 0 || (upper && cmp == 0)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Complete the last argument of input as a file path. Items point into the cached listing and carry negative ids,
+// which never clash with index ids. A directory not listed yet is requested and shows up after completer_collect.
+// total counts every completion, the first MAX_RESULTS are kept and complete_page() turns to the rest.
+int complete_path(PathCompleter *completer, const char *input, ResultList *result_list) {
+    return complete_page(completer, input, 0, result_list);
+}
+
+// Complete input again and keep the completions from rank offset on
+int complete_page(PathCompleter *completer, const char *input, int offset, ResultList *result_list) {
+    char dir_path[PATH_MAX];
+
+    result_list->count = 0;
+    result_list->selected = 0;
+    result_list->offset = 0;
+    result_list->total = 0;
+
+    char word[MAX_INPUT_LENGTH];
+    if (unescape_word(word, sizeof(word), last_word(input, NULL)) != 0) {
+        return 0;
+    }
+    const char *slash = strrchr(word, '/');
+    size_t dir_len = slash ? (size_t)(slash - word) + 1 : 0;
+    const char *base = word + dir_len;
+    size_t base_len = strlen(base);
+    if (expand_dir(dir_path, sizeof(dir_path), word, dir_len) != 0) {
+        return 0;
+    }
+
+    int found;
+    int slot = cache_slot(completer, dir_path, &found);
+    CompleteListing *listing = completer->cache[slot];
+    if (!found) {
+        // Keep a placeholder so the slot is ours, the worker fills it in
+        CompleteListing *placeholder = calloc(1, sizeof(CompleteListing));
+        if (!placeholder || !(placeholder->path = strdup(dir_path))) {
+            free(placeholder);
+            return 0;
+        }
+        placeholder->loading = 1;
+        listing_free(listing);
+        listing = completer->cache[slot] = placeholder;
+        completer_request(completer, dir_path);
+    } else if (listing->loading || monotonic_seconds() - listing->loaded_at >= COMPLETE_CACHE_SECONDS) {
+        // Keep showing what we have while a fresh copy loads
+        completer_request(completer, dir_path);
+    }
+    listing->last_used = ++completer->clock;
+
+    // Entries are sorted, so the ones starting with base form one block, and so do the hidden ones.
+    // Those are only shown once a dot has been typed.
+    int lo = listing_bound(listing, base, base_len, 0);
+    int end = listing_bound(listing, base, base_len, 1);
+    int hidden_lo = lo, hidden_end = lo;
+    if (base[0] != '.') {
+        hidden_lo = listing_bound(listing, ".", 1, 0);
+        hidden_end = listing_bound(listing, ".", 1, 1);
+        hidden_lo = hidden_lo < lo ? lo : hidden_lo > end ? end : hidden_lo;
+        hidden_end = hidden_end < hidden_lo ? hidden_lo : hidden_end > end ? end : hidden_end;
+    }
+    int total = (end - lo) - (hidden_end - hidden_lo);
+    if (offset > total - 1) {
+        offset = total - 1;
+    }
+    if (offset < 0) {
+        offset = 0;
+    }
+
+    for (int rank = offset; rank < total && result_list->count < MAX_RESULTS; rank++) {
+        int i = lo + rank;
+        if (i >= hidden_lo) {
+            i += hidden_end - hidden_lo;
+        }
+        result_list->ids[result_list->count] = -1 - (((listing->serial & 0x7ff) << 20) | (i & 0xfffff));
+        result_list->items[result_list->count++] = listing->entries[i];
+    }
+    result_list->offset = offset;
+    result_list->total = total;
+    return result_list->count;
+}
+
+// Replace the last path component being typed with a completion, escaped so the command gets it as one word
+// however it is run. Returns the new input length; a completion that doesn't fit leaves input as it was.
+int complete_apply(char *input, size_t size, const char *completion) {
+    char *word = input + (last_word(input, NULL) - input);
+    char *slash = strrchr(word, '/');
+    char *base = slash ? slash + 1 : word;
+    size_t len = base - input;
+    char escaped[MAX_INPUT_LENGTH];
+    size_t escaped_len = 0;
+
+    // Close a quote left open before the completion, the escaping below is meant for outside of one
+    char saved = *base, quote;
+    *base = '\0';
+    last_word(input, &quote);
+    *base = saved;
+    if (quote) {
+        escaped[escaped_len++] = quote;
+    }
+
+    for (const char *c = completion; *c; c++) {
+        // A backslash would join lines at a newline, which only quotes keep
+        const char *text = *c == '\n' ? "'\n'" : NULL;
+        char pair[3] = { '\\', *c, '\0' };
+        if (!text) {
+            text = *c == ' ' || *c == '\t' || strchr(LAUNCH_SHELL_CHARS, *c) ? pair : pair + 1;
+        }
+        size_t text_len = strlen(text);
+        if (len + escaped_len + text_len >= size || escaped_len + text_len >= sizeof(escaped)) {
+            return strlen(input);
+        }
+        memcpy(escaped + escaped_len, text, text_len);
+        escaped_len += text_len;
+    }
+    memcpy(base, escaped, escaped_len);
+    base[escaped_len] = '\0';
+    return len + escaped_len;
+}
+
+// Stop the worker and wait for it. A directory it is in the middle of reading is finished first,
+// which is one bounded readdir, so nothing is left pointing at completer once this returns.
+void completer_free(PathCompleter *completer) {
+    if (completer->started) {
+        pthread_mutex_lock(&completer->lock);
+        completer->quit = 1;
+        pthread_cond_signal(&completer->wake);
+        pthread_mutex_unlock(&completer->lock);
+        pthread_join(completer->thread, NULL);
+    }
+
+    for (int i = 0; i < COMPLETE_CACHE_DIRS; i++) {
+        listing_free(completer->cache[i]);
+    }
+    while (completer->finished) {
+        CompleteListing *listing = completer->finished;
+        completer->finished = listing->next;
+        listing_free(listing);
+    }
+    if (completer->wake_fd >= 0) {
+        close(completer->wake_fd);
+    }
+    pthread_mutex_destroy(&completer->lock);
+    pthread_cond_destroy(&completer->wake);
+    memset(completer, 0, sizeof(*completer));
+}
@@ -0,0 +1,51 @@
+#ifndef COMPLETE_UTILS_H
+#define COMPLETE_UTILS_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "path_utils.h"
+
+// Sorted entries of one directory, directories carry a trailing '/'
+typedef struct CompleteListing {
+    char *path;
+    char *names;                    // NUL-separated entry names
+    const char **entries;           // Sorted pointers into names
+    int count;
+    int serial;                     // Load number, part of the ids handed to the ResultList
+    int loading;                    // Placeholder until the worker delivers the first listing
+    uint64_t loaded_at;             // CLOCK_MONOTONIC seconds
+    uint64_t last_used;             // LRU stamp
+    struct CompleteListing *next;   // Worker -> main thread hand-off list
+} CompleteListing;
+
+// Completes file path arguments from cached directory listings.
+// Listings are read on a background thread, so a slow or network-mounted directory never holds up typing;
+// wake_fd becomes readable when one arrives and completer_collect takes it into the cache.
+typedef struct {
+    CompleteListing *cache[COMPLETE_CACHE_DIRS];
+    uint64_t clock;
+    int serial;
+    int wake_fd;
+
+    pthread_t thread;
+    int started;
+    pthread_mutex_t lock;           // Guards everything below
+    pthread_cond_t wake;
+    char request[PATH_MAX];         // Next directory to read, "" if none; a newer request replaces it
+    char loading[PATH_MAX];         // Directory the worker is reading right now
+    CompleteListing *finished;
+    int quit;
+} PathCompleter;
+
+int completer_init(PathCompleter *completer);
+int complete_path(PathCompleter *completer, const char *input, ResultList *result_list);
+int complete_page(PathCompleter *completer, const char *input, int offset, ResultList *result_list);
+int completer_collect(PathCompleter *completer);
+int complete_apply(char *input, size_t size, const char *completion);
+void completer_free(PathCompleter *completer);
+
+#endif
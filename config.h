@@ -14,7 +14,13 @@
 
 // Maximum limits
 #define MAX_INPUT_LENGTH 256         // Maximum length of the input
-#define MAX_RESULTS 20               // Maximum number of results to display
+#define MAX_RESULTS 20               // Results fetched per page, the rest are reached by scrolling
+
+// Rows of suggestions listed under the input instead of beside it, 0 for one line (-l overrides, up to MAX_RESULTS)
+#define VERTICAL_LINES 0
+
+// Uncomment the following line to match suggestions fuzzily (as a subsequence) by default, -f does the same
+//#define ENABLE_FUZZY
 
 // Color configurations (RGB Hex format)
 #define INPUT_TEXT_COLOR 0xffffff    // Color for the input text (black)
@@ -25,6 +31,30 @@
 // Define a custom font as a macro (you can change this value to any font name)
 #define CUSTOM_FONT "Hack Nerd Font Regular"
 
+// Comment out the following line to rescan $PATH on every launch instead of using the cache
+#define ENABLE_PATH_CACHE
+#define CACHE_DIR_NAME "simplesearch"          // Directory under $XDG_CACHE_HOME (or ~/.cache)
+#define CACHE_FILE_NAME "path_index"           // Binary cache of $PATH executables
+
+// Comment out the following line to stop ranking suggestions by how often and how recently they were launched
+#define ENABLE_HISTORY
+#define HISTORY_FILE_NAME "history"            // Launch history, next to the $PATH cache
+#define HISTORY_SLOTS 4096                     // Executables remembered (64 bytes each)
+
+// Worker threads scanning $PATH directories in the background (capped at the number of CPUs)
+#define SCAN_THREADS 4
+
+// Threads splitting a search over a large stdin list (-s), capped at the number of CPUs
+#define FILTER_THREADS 4
+#define FILTER_PARALLEL_MIN 262144             // Candidates below which one thread filters alone
+
+// File path completion for arguments after the first space
+#define COMPLETE_CACHE_DIRS 16                 // Directory listings kept, the least recently used is dropped first
+#define COMPLETE_CACHE_SECONDS 5               // Age after which a listing is reloaded in the background
+
+// Socket a resident instance (-D) listens on, under $XDG_RUNTIME_DIR (or /tmp with the uid appended)
+#define DAEMON_SOCKET_NAME "simplesearch.sock"
+
 // User-defined timeout (in seconds)
 #define TIMEOUT_SECONDS 7             // Time in seconds for user-defined timeout
 
@@ -0,0 +1,109 @@
+#define _GNU_SOURCE  // accept4()
+
+#include "daemon_utils.h"
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Build the socket path, per user so two people on one machine don't share a launcher
+int daemon_socket_path(char *buf, size_t size) {
+    const char *base = getenv("XDG_RUNTIME_DIR");
+    int len;
+
+    if (base && base[0] == '/') {
+        len = snprintf(buf, size, "%s/%s", base, DAEMON_SOCKET_NAME);
+    } else {
+        len = snprintf(buf, size, "/tmp/%s-%u", DAEMON_SOCKET_NAME, (unsigned)getuid());
+    }
+    return len >= 0 && (size_t)len < size ? 0 : -1;
+}
+
+static int daemon_address(struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    return daemon_socket_path(addr->sun_path, sizeof(addr->sun_path));
+}
+
+// Bind the socket the resident instance waits on, replacing one left behind by a crash
+int daemon_listen(void) {
+    struct sockaddr_un addr;
+    if (daemon_address(&addr) != 0) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 && errno == EADDRINUSE) {
+        // Nobody answered daemon_notify() before we got here, so the file is stale
+        unlink(addr.sun_path);
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    if (listen(fd, 8) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Send one command to the resident instance, fails right away if there is none
+int daemon_notify(char command) {
+    struct sockaddr_un addr;
+    if (daemon_address(&addr) != 0) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int result = -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 && write(fd, &command, 1) == 1) {
+        result = 0;
+    }
+    close(fd);
+    return result;
+}
+
+// Accept a pending connection and read its command, -1 once there are none left
+int daemon_receive(int listen_fd) {
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            return -1;
+        }
+
+        // Clients write their byte before anything else, so this only waits on a misbehaving one
+        struct timeval timeout = { .tv_sec = 0, .tv_usec = 100000 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        char command;
+        ssize_t got = read(fd, &command, 1);
+        close(fd);
+        if (got == 1) {
+            return (unsigned char)command;
+        }
+    }
+}
+
+void daemon_close(int listen_fd) {
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+    if (listen_fd < 0) {
+        return;
+    }
+    close(listen_fd);
+    if (daemon_socket_path(path, sizeof(path)) == 0) {
+        unlink(path);
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef DAEMON_UTILS_H
+#define DAEMON_UTILS_H
+
+#include <stddef.h>
+
+#define DAEMON_SHOW 's'             // Map the window and take the focus
+#define DAEMON_QUIT 'q'             // Shut the resident instance down
+
+// A resident instance listens on a UNIX socket in $XDG_RUNTIME_DIR (or /tmp),
+// every command is a single byte sent over a short-lived connection.
+int daemon_socket_path(char *buf, size_t size);
+int daemon_listen(void);
+int daemon_notify(char command);
+int daemon_receive(int listen_fd);
+void daemon_close(int listen_fd);
+
+#endif
@@ -1,68 +1,324 @@
 #include "draw_utils.h"
 #include "config.h"
+#include "trace_utils.h"
 #include <X11/Xft/Xft.h>  // Include Xft headers for modern font handling
 
-// Draw menu with suggestions and highlights for the selected item using Xft for font rendering
-void draw_menu(Display *display, Window window, GC gc, char *input, ResultList *result_list, XftFont *font, XftDraw *draw, XftColor *input_xft_color, XftColor *suggestion_bg_color) {
-    // Clear the window and set the background color
-    XSetWindowBackground(display, window, WINDOW_BG_COLOR);
-    XClearWindow(display, window);
+// Create the back buffer the size of the window, which holds the input row and then rows of suggestions
+void layout_init(MenuLayout *layout, Display *display, Window window, int rows, int lines) {
+    XWindowAttributes attributes;
 
-    // Calculate line height with padding (for each suggestion)
-    int line_height = font->ascent + font->descent + TOP_PADDING + BOTTOM_PADDING;
+    memset(layout, 0, sizeof(*layout));
+    XGetWindowAttributes(display, window, &attributes);
+    layout->window_width = attributes.width;
+    layout->window_height = attributes.height;
+    layout->drawn_selected = -1;
+    layout->rows = rows;
+    layout->lines = lines;
+    for (int i = 0; i < LAYOUT_LINE_WIDTHS; i++) {
+        layout->line_widths[i].id = -1;
+    }
+    layout->row_height = attributes.height / (rows + 1);
 
-    // Get the width of the input text using XftTextExtentsUtf8
-    int input_len = strlen(input);
-    XGlyphInfo extents;
-    XftTextExtentsUtf8(display, font, (XftChar8 *)input, input_len, &extents);
-    int input_width = extents.width;
+    layout->pixmap = XCreatePixmap(display, window, attributes.width, attributes.height, attributes.depth);
+    layout->draw = XftDrawCreate(display, layout->pixmap, attributes.visual, attributes.colormap);
 
-    // Draw the input text at the top-left corner of the window using XftDrawStringUtf8
-    XftDrawStringUtf8(draw, input_xft_color, font, 10, line_height/2 + TOP_PADDING/2, (XftChar8 *)input, input_len);
+    // Every pixel comes from the back buffer, stop the server clearing the window first
+    XSetWindowBackgroundPixmap(display, window, None);
+}
 
-    if (result_list->count > 0) {
-        // Starting position for suggestions (right of the input text, with extra gap)
-        int x_pos = 10 + input_width + INPUT_TO_SUGGESTION_GAP;  // Increased gap here
+// Drop the measured widths and positions, for when index ids start naming other entries
+void layout_forget(MenuLayout *layout) {
+    if (layout->widths) {
+        memset(layout->widths, 0, sizeof(int) * layout->width_count);
+    }
+    for (int i = 0; i < LAYOUT_LINE_WIDTHS; i++) {
+        layout->line_widths[i].id = -1;
+    }
+    layout->valid = 0;
+}
 
-        // Get screen width for boundary checks
-        int screen_width = DisplayWidth(display, DefaultScreen(display));
+void layout_free(MenuLayout *layout, Display *display) {
+    if (layout->draw) {
+        XftDrawDestroy(layout->draw);
+    }
+    if (layout->pixmap) {
+        XFreePixmap(display, layout->pixmap);
+    }
+    free(layout->widths);
+    memset(layout, 0, sizeof(*layout));
+}
 
-        // Loop through suggestions
-        for (int i = 0; i < result_list->count; i++) {
-            int suggestion_len = strlen(result_list->items[i]);
-            XftTextExtentsUtf8(display, font, (XftChar8 *)result_list->items[i], suggestion_len, &extents);
-            int suggestion_width = extents.width;
+// Width of an index entry's text, measured the first time it is shown.
+// Path completions have negative ids and are measured every time. Stdin lines only keep the widths
+// of recently shown lines, so paging deep into a huge input doesn't grow a table to the last line's id.
+static int entry_width(Display *display, XftFont *font, MenuLayout *layout, int id, const char *text) {
+    if (id < 0) {
+        XGlyphInfo extents;
+        XftTextExtentsUtf8(display, font, (XftChar8 *)text, strlen(text), &extents);
+        return extents.width;
+    }
+    if (layout->lines) {
+        LineWidth *slot = &layout->line_widths[id & (LAYOUT_LINE_WIDTHS - 1)];
+        if (slot->id != id) {
+            XGlyphInfo extents;
+            XftTextExtentsUtf8(display, font, (XftChar8 *)text, strlen(text), &extents);
+            slot->id = id;
+            slot->width = extents.width;
+        }
+        return slot->width;
+    }
+    if (id >= layout->width_count) {
+        int count = layout->width_count ? layout->width_count : 1024;
+        while (count <= id) {
+            count *= 2;
+        }
+        int *widths = realloc(layout->widths, sizeof(int) * count);
+        if (!widths) {
+            XGlyphInfo extents;
+            XftTextExtentsUtf8(display, font, (XftChar8 *)text, strlen(text), &extents);
+            return extents.width;
+        }
+        memset(widths + layout->width_count, 0, sizeof(int) * (count - layout->width_count));
+        layout->widths = widths;
+        layout->width_count = count;
+    }
 
-            // Stop if the suggestion exceeds the screen width
-            if (x_pos + suggestion_width + SUGGESTION_OFFSET > screen_width) {
-                break;
-            }
+    if (layout->widths[id] == 0) {
+        XGlyphInfo extents;
+        XftTextExtentsUtf8(display, font, (XftChar8 *)text, strlen(text), &extents);
+        layout->widths[id] = extents.width;
+    }
+    return layout->widths[id];
+}
+
+// Recompute where the suggestions go, only when the input width or the results changed.
+// Returns LAYOUT_INPUT and/or LAYOUT_RESULTS for what changed, *old_input_width gets the previous width.
+static int layout_update(Display *display, XftFont *font, const char *input, const ResultList *result_list, MenuLayout *layout, int *old_input_width) {
+    int changed = 0;
 
+    *old_input_width = layout->input_width;
+    if (!layout->valid || strcmp(layout->input, input) != 0) {
+        XGlyphInfo extents;
+        XftTextExtentsUtf8(display, font, (XftChar8 *)input, strlen(input), &extents);
+        strncpy(layout->input, input, MAX_INPUT_LENGTH - 1);
+        layout->input[MAX_INPUT_LENGTH - 1] = '\0';
+        changed |= LAYOUT_INPUT;
+
+        // Suggestions start right of the input, so they only move if its width changes
+        if (extents.width != layout->input_width && result_list->count > 0 && layout->rows == 0) {
+            changed |= LAYOUT_RESULTS;
+        }
+        layout->input_width = extents.width;
+    }
+
+    if (layout->valid && !(changed & LAYOUT_RESULTS) && layout->count == result_list->count &&
+        memcmp(layout->ids, result_list->ids, sizeof(int) * result_list->count) == 0) {
+        return changed;
+    }
+
+    // Starting position for suggestions (right of the input text, with extra gap)
+    int x_pos = 10 + layout->input_width + INPUT_TO_SUGGESTION_GAP;
+
+    layout->count = result_list->count;
+    layout->visible = 0;
+    memcpy(layout->ids, result_list->ids, sizeof(int) * result_list->count);
+    if (layout->rows > 0) {
+        // One suggestion per row, clipped at the window edge, nothing to measure
+        for (int i = 0; i < result_list->count && i < layout->rows; i++) {
+            layout->x[i] = 10;
+            layout->width[i] = layout->window_width - 20;
+            layout->visible++;
+        }
+        layout->valid = 1;
+        return changed | LAYOUT_RESULTS;
+    }
+    for (int i = 0; i < result_list->count; i++) {
+        int suggestion_width = entry_width(display, font, layout, result_list->ids[i], result_list->items[i]);
+
+        // Stop if the suggestion exceeds the window width, but keep the first of the page, clipped
+        if (i > 0 && x_pos + suggestion_width + SUGGESTION_OFFSET > layout->window_width) {
+            break;
+        }
+        layout->x[i] = x_pos;
+        layout->width[i] = suggestion_width;
+        layout->visible++;
+
+        // Move the x position for the next suggestion (leave larger gap)
+        x_pos += suggestion_width + SUGGESTION_OFFSET * 3;  // Increased gap between suggestions
+    }
+    layout->valid = 1;
+    return changed | LAYOUT_RESULTS;
+}
+
+// Part of the frame to redraw, empty while x1 <= x0
+typedef struct {
+    int x0, y0, x1, y1;
+} Damage;
+
+// Grow the damage to cover the box [x0, x1) x [y0, y1)
+static void damage(Damage *d, int x0, int y0, int x1, int y1) {
+    if (d->x1 <= d->x0) {
+        *d = (Damage){ x0, y0, x1, y1 };
+        return;
+    }
+    d->x0 = x0 < d->x0 ? x0 : d->x0;
+    d->y0 = y0 < d->y0 ? y0 : d->y0;
+    d->x1 = x1 > d->x1 ? x1 : d->x1;
+    d->y1 = y1 > d->y1 ? y1 : d->y1;
+}
+
+// Box suggestion i is drawn in, including its highlight: a column of the window, or a row in vertical mode
+static Damage suggestion_box(const MenuLayout *layout, int i) {
+    if (layout->rows > 0) {
+        return (Damage){ 0, (i + 1) * layout->row_height, layout->window_width, (i + 2) * layout->row_height };
+    }
+    return (Damage){ layout->x[i] - SUGGESTION_OFFSET, 0, layout->x[i] + layout->width[i] + SUGGESTION_OFFSET, layout->window_height };
+}
+
+// Grow the damage to cover suggestion i
+static void damage_suggestion(const MenuLayout *layout, int i, Damage *d) {
+    if (i >= 0 && i < layout->visible) {
+        Damage box = suggestion_box(layout, i);
+        damage(d, box.x0, box.y0, box.x1, box.y1);
+    }
+}
+
+// How many of result_list's items fit on screen, laid out ahead of the next draw_menu()
+int layout_visible(Display *display, XftFont *font, const char *input, const ResultList *result_list, MenuLayout *layout) {
+    int old_input_width;
+    if (layout_update(display, font, input, result_list, layout, &old_input_width)) {
+        // The next frame can no longer tell what moved
+        layout->dirty = 1;
+    }
+    return layout->visible;
+}
+
+// How many items at the end of result_list fit on screen together, at least one. Paging backwards
+// ends a page on the item before the current one, this finds where that page has to start.
+int layout_fit_back(Display *display, XftFont *font, MenuLayout *layout, const char *input, const ResultList *result_list) {
+    if (layout->rows > 0) {
+        return result_list->count < layout->rows ? (result_list->count > 0 ? result_list->count : 1) : layout->rows;
+    }
+
+    // Laid out the same way as layout_update, with the input as it is now
+    int input_width = layout->input_width;
+    if (!layout->valid || strcmp(layout->input, input) != 0) {
+        XGlyphInfo extents;
+        XftTextExtentsUtf8(display, font, (XftChar8 *)input, strlen(input), &extents);
+        input_width = extents.width;
+    }
+    int x_end = 10 + input_width + INPUT_TO_SUGGESTION_GAP + SUGGESTION_OFFSET;
+    int fit = 0;
+    for (int i = result_list->count - 1; i >= 0; i--) {
+        x_end += entry_width(display, font, layout, result_list->ids[i], result_list->items[i]) + (fit > 0 ? SUGGESTION_OFFSET * 3 : 0);
+        if (x_end > layout->window_width) {
+            break;
+        }
+        fit++;
+    }
+    return fit > 0 ? fit : 1;
+}
+
+// Draw menu with suggestions and highlights for the selected item using Xft for font rendering.
+// Only the columns that changed since the last frame are redrawn into the back buffer and copied to the window.
+void draw_menu(Display *display, Window window, GC gc, char *input, ResultList *result_list, XftFont *font, XftColor *input_xft_color, XftColor *suggestion_bg_color, MenuLayout *layout) {
+    uint64_t draw_start = trace_begin();
+    int old_input_width;
+    int changed = layout_update(display, font, input, result_list, layout, &old_input_width);
+    trace_end(TRACE_LAYOUT, draw_start);
+    Damage d = {0};
+
+    if (!layout->drawn || layout->dirty || (changed & LAYOUT_RESULTS)) {
+        d = (Damage){ 0, 0, layout->window_width, layout->window_height };
+    } else {
+        if (changed & LAYOUT_INPUT) {
+            int input_width = old_input_width > layout->input_width ? old_input_width : layout->input_width;
+            damage(&d, 0, 0, 10 + input_width + INPUT_TO_SUGGESTION_GAP / 2, layout->row_height);
+        }
+        if (result_list->selected != layout->drawn_selected) {
+            damage_suggestion(layout, layout->drawn_selected, &d);
+            damage_suggestion(layout, result_list->selected, &d);
+        }
+    }
+    if (d.x0 < 0) {
+        d.x0 = 0;
+    }
+    if (d.x1 > layout->window_width) {
+        d.x1 = layout->window_width;
+    }
+    if (d.x1 <= d.x0) {
+        trace_end(TRACE_DRAW, draw_start);
+        return;
+    }
+
+    // Keep every draw call inside the damaged box
+    XRectangle clip = { d.x0, d.y0, d.x1 - d.x0, d.y1 - d.y0 };
+    XSetClipRectangles(display, gc, 0, 0, &clip, 1, Unsorted);
+    XftDrawSetClipRectangles(layout->draw, 0, 0, &clip, 1);
+
+    XSetForeground(display, gc, WINDOW_BG_COLOR);
+    XFillRectangle(display, layout->pixmap, gc, d.x0, d.y0, d.x1 - d.x0, d.y1 - d.y0);
+
+    // Calculate line height with padding (for each suggestion)
+    int line_height = font->ascent + font->descent + TOP_PADDING + BOTTOM_PADDING;
+    int baseline = line_height/2 + TOP_PADDING/2;
+
+    // Draw the input text at the top-left corner of the window using XftDrawStringUtf8
+    if (d.x0 < 10 + layout->input_width && d.y0 < layout->row_height) {
+        XftDrawStringUtf8(layout->draw, input_xft_color, font, 10, baseline, (XftChar8 *)input, strlen(input));
+    }
+
+    // Loop through the suggestions that fit on screen and overlap the damage
+    for (int i = 0; i < layout->visible; i++) {
+        Damage box = suggestion_box(layout, i);
+        if (box.x1 <= d.x0 || box.x0 >= d.x1 || box.y1 <= d.y0 || box.y0 >= d.y1) {
+            continue;
+        }
+        int y = layout->rows > 0 ? box.y0 : 0;
 #ifdef ENABLE_HIGHLIGHT
-            // Draw background for the selected suggestion (only if highlighting is enabled)
-            if (i == result_list->selected) {
-                // Set the background color for the selected suggestion using Xft
-                XSetForeground(display, gc, SUGGESTION_BG_COLOR);
+        // Draw background for the selected suggestion (only if highlighting is enabled)
+        if (i == result_list->selected) {
+            // Set the background color for the selected suggestion
+            XSetForeground(display, gc, SUGGESTION_BG_COLOR);
 
+            if (layout->rows > 0) {
+                // The whole row
+                XFillRectangle(display, layout->pixmap, gc, 0, box.y0, layout->window_width, layout->row_height);
+            } else {
                 // Draw a filled rectangle behind the selected suggestion (adjust y position and width)
                 int rect_y = TOP_PADDING - 10; // Align with the top padding
-                XFillRectangle(display, window, gc, x_pos - SUGGESTION_OFFSET, rect_y, suggestion_width + SUGGESTION_OFFSET * 2, line_height);
+                XFillRectangle(display, layout->pixmap, gc, layout->x[i] - SUGGESTION_OFFSET, rect_y, layout->width[i] + SUGGESTION_OFFSET * 2, line_height);
             }
-#endif
-            // Draw the suggestion text using XftDrawStringUtf8
-            XftDrawStringUtf8(draw, suggestion_bg_color, font, x_pos, line_height/2 + TOP_PADDING/2, (XftChar8 *)result_list->items[i], suggestion_len);
-
-            // Move the x position for the next suggestion (leave larger gap)
-            x_pos += suggestion_width + SUGGESTION_OFFSET * 3;  // Increased gap between suggestions
         }
+#endif
+        // Draw the suggestion text using XftDrawStringUtf8
+        XftDrawStringUtf8(layout->draw, suggestion_bg_color, font, layout->x[i], y + baseline, (XftChar8 *)result_list->items[i], strlen(result_list->items[i]));
     }
 
-    // Flush changes to the display
+    XSetClipMask(display, gc, None);
+    XftDrawSetClip(layout->draw, NULL);
+    layout->drawn = 1;
+    layout->dirty = 0;
+    layout->drawn_selected = result_list->selected;
+
+    // Put the new frame on screen in one request
+    XCopyArea(display, layout->pixmap, window, gc, d.x0, d.y0, d.x1 - d.x0, d.y1 - d.y0, d.x0, d.y0);
+    uint64_t flush_start = trace_begin();
     XFlush(display);
+    trace_end(TRACE_FLUSH, flush_start);
+    trace_end(TRACE_DRAW, draw_start);
+}
+
+// Copy the last frame to the window again, e.g. after an Expose
+void present_menu(Display *display, Window window, GC gc, MenuLayout *layout) {
+    if (layout->drawn) {
+        XCopyArea(display, layout->pixmap, window, gc, 0, 0, layout->window_width, layout->window_height, 0, 0);
+        XFlush(display);
+    }
 }
 
 // Ensure the window has focus and raise it to the top
 void ensure_window_focus(Display *display, Window window) {
     XRaiseWindow(display, window);
     XSetInputFocus(display, window, RevertToParent, CurrentTime);
-}
\ No newline at end of file
+}
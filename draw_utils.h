@@ -7,8 +7,54 @@
 #include "path_utils.h"  // For using ResultList
 #include "config.h"
 
+// What changed since the last frame, see layout_update()
+#define LAYOUT_INPUT 1      // The input text
+#define LAYOUT_RESULTS 2    // Which suggestions are shown or where they go
+#define LAYOUT_LINE_WIDTHS 256      // Widths remembered for stdin lines, which can number in the millions (power of two)
+
+// A remembered width of one stdin line
+typedef struct {
+    int id;                 // Line the width belongs to, -1 for an empty slot
+    int width;
+} LineWidth;
+
+// Text widths, suggestion positions and the off-screen frame kept between draws.
+// Widths are cached per index entry, positions are only recomputed when the results or the input width change.
+// Only the page of results the ResultList holds is ever measured or drawn.
+typedef struct {
+    int *widths;                    // widths[id] -> text width of index entry id, 0 until measured
+    int width_count;
+    int lines;                      // Ids are stdin lines, their widths go in line_widths instead
+    LineWidth line_widths[LAYOUT_LINE_WIDTHS];  // Slot id % LAYOUT_LINE_WIDTHS, the last width measured there
+    char input[MAX_INPUT_LENGTH];   // Input the cached input_width belongs to
+    int input_width;
+    int ids[MAX_RESULTS];           // Results the positions below were computed for
+    int count;
+    int x[MAX_RESULTS];             // Left edge of each suggestion that fits on screen
+    int width[MAX_RESULTS];
+    int visible;
+    int valid;
+    int rows;                       // Suggestions listed one per row under the input, 0 to put them beside it
+    int row_height;
+    int dirty;                      // Laid out by layout_visible() since the last frame, redraw it all
+
+    // Back buffer: frames are drawn into this pixmap and copied to the window in one XCopyArea
+    Pixmap pixmap;
+    XftDraw *draw;
+    int window_width;
+    int window_height;
+    int drawn;                      // The pixmap holds a complete frame
+    int drawn_selected;             // Selection the pixmap was drawn with
+} MenuLayout;
+
 // Update function signatures to use Xft
-void draw_menu(Display *display, Window window, GC gc, char *input, ResultList *result_list, XftFont *font, XftDraw *draw, XftColor *xft_color, XftColor *highlight_color);
+void layout_init(MenuLayout *layout, Display *display, Window window, int rows, int lines);
+void layout_free(MenuLayout *layout, Display *display);
+void layout_forget(MenuLayout *layout);
+void draw_menu(Display *display, Window window, GC gc, char *input, ResultList *result_list, XftFont *font, XftColor *xft_color, XftColor *highlight_color, MenuLayout *layout);
+void present_menu(Display *display, Window window, GC gc, MenuLayout *layout);
+int layout_visible(Display *display, XftFont *font, const char *input, const ResultList *result_list, MenuLayout *layout);
+int layout_fit_back(Display *display, XftFont *font, MenuLayout *layout, const char *input, const ResultList *result_list);
 void ensure_window_focus(Display *display, Window window);
 
 #endif
@@ -0,0 +1,204 @@
+#include "history_utils.h"
+#include "cache_utils.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HISTORY_FILE_SIZE (sizeof(HistoryHeader) + sizeof(HistoryEntry) * HISTORY_SLOTS)
+
+// FNV-1a, with the low bit set so a tag is never 0
+static uint32_t history_tag(const char *name) {
+    uint32_t hash = 2166136261u;
+
+    for (; *name; name++) {
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    }
+    return hash | 1;
+}
+
+// Launch count weighted by how long ago the last launch was
+static uint32_t frecency(const HistoryEntry *entry, uint32_t now) {
+    uint32_t count = __atomic_load_n(&entry->count, __ATOMIC_RELAXED);
+    uint32_t age = now - __atomic_load_n(&entry->last_used, __ATOMIC_RELAXED);
+    uint32_t day = 24 * 60 * 60;
+    uint32_t weight = age < 4 * day ? 100 : age < 14 * day ? 70 : age < 31 * day ? 50 : age < 90 * day ? 30 : 10;
+    return count * weight;
+}
+
+// Map the history file, creating it with an empty table if it is missing or from another version
+int history_open(History *history) {
+    char path[1024];
+    struct stat st;
+
+    memset(history, 0, sizeof(*history));
+    if (cache_file_path(path, sizeof(path), HISTORY_FILE_NAME, 1) != 0) {
+        return -1;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    // Mapping past the end of a short file would fault on first touch, so both truncations have to succeed
+    int fresh = st.st_size != (off_t)HISTORY_FILE_SIZE;
+    if (fresh && (ftruncate(fd, 0) != 0 || ftruncate(fd, HISTORY_FILE_SIZE) != 0)) {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, HISTORY_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    history->map = map;
+    history->size = HISTORY_FILE_SIZE;
+    history->header = map;
+    history->entries = (HistoryEntry *)(history->header + 1);
+
+    if (fresh || history->header->magic != HISTORY_MAGIC || history->header->version != HISTORY_VERSION ||
+        history->header->slots != HISTORY_SLOTS) {
+        memset(map, 0, HISTORY_FILE_SIZE);
+        history->header->version = HISTORY_VERSION;
+        history->header->slots = HISTORY_SLOTS;
+        __atomic_store_n(&history->header->magic, HISTORY_MAGIC, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+// Tag of a slot once whoever is writing it has finished, HISTORY_TAG_BUSY if they take too long
+static uint32_t settled_tag(HistoryEntry *entry) {
+    uint32_t tag = __atomic_load_n(&entry->tag, __ATOMIC_ACQUIRE);
+
+    for (int spin = 0; tag == HISTORY_TAG_BUSY && spin < HISTORY_BUSY_SPINS; spin++) {
+        tag = __atomic_load_n(&entry->tag, __ATOMIC_ACQUIRE);
+    }
+    return tag;
+}
+
+// Fill a slot this process holds as HISTORY_TAG_BUSY, then hand it back under the real tag
+static void history_fill(HistoryEntry *entry, uint32_t tag, const char *name, size_t len, uint32_t now) {
+    memset(entry->name, 0, HISTORY_NAME_SIZE);
+    memcpy(entry->name, name, len + 1);
+    __atomic_store_n(&entry->count, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->last_used, now, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->tag, tag, __ATOMIC_RELEASE);
+}
+
+// Count one launch of name. A full probe window gives up its least used entry.
+void history_record(History *history, const char *name) {
+    size_t len = strlen(name);
+    uint32_t now = (uint32_t)time(NULL);
+
+    if (!history->map || len == 0 || len >= HISTORY_NAME_SIZE) {
+        return;
+    }
+
+    uint32_t tag = history_tag(name);
+    // Another launcher can take the slot picked for eviction first, then the window is looked at again
+    for (int attempt = 0; attempt < HISTORY_PROBE; attempt++) {
+        HistoryEntry *weakest = NULL;
+        uint32_t weakest_tag = 0;
+        uint32_t weakest_score = UINT32_MAX;
+
+        for (int probe = 0; probe < HISTORY_PROBE; probe++) {
+            HistoryEntry *entry = &history->entries[(tag + probe) % HISTORY_SLOTS];
+            uint32_t current = settled_tag(entry);
+
+            if (current == 0) {
+                uint32_t expected = 0;
+                if (__atomic_compare_exchange_n(&entry->tag, &expected, HISTORY_TAG_BUSY, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                    history_fill(entry, tag, name, len, now);
+                    return;
+                }
+                current = expected == HISTORY_TAG_BUSY ? settled_tag(entry) : expected;
+            }
+            if (current == HISTORY_TAG_BUSY) {
+                // Still being written, neither a match nor something to evict
+                continue;
+            }
+            if (current == tag && strcmp(entry->name, name) == 0 && __atomic_load_n(&entry->tag, __ATOMIC_ACQUIRE) == tag) {
+                __atomic_store_n(&entry->last_used, now, __ATOMIC_RELAXED);
+                __atomic_fetch_add(&entry->count, 1, __ATOMIC_RELEASE);
+                return;
+            }
+
+            uint32_t score = frecency(entry, now);
+            if (score < weakest_score) {
+                weakest = entry;
+                weakest_tag = current;
+                weakest_score = score;
+            }
+        }
+
+        // Every slot is taken, reuse the weakest one unless it changed since it was looked at
+        if (!weakest) {
+            return;
+        }
+        if (__atomic_compare_exchange_n(&weakest->tag, &weakest_tag, HISTORY_TAG_BUSY, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            history_fill(weakest, tag, name, len, now);
+            return;
+        }
+    }
+}
+
+// Turn the history into a per-id bonus for the current index, so ranking is one array read per candidate.
+// Cheap enough to redo whenever the index changes: one binary search per recorded name.
+const int *history_rank(History *history, const ExecIndex *index) {
+    uint32_t now = (uint32_t)time(NULL);
+
+    if (!history->map) {
+        return NULL;
+    }
+    if (history->boost_cap < index->id_count) {
+        int *boost = realloc(history->boost, sizeof(int) * index->id_count);
+        if (!boost) {
+            return NULL;
+        }
+        history->boost = boost;
+        history->boost_cap = index->id_count;
+    }
+    memset(history->boost, 0, sizeof(int) * history->boost_cap);
+
+    for (int i = 0; i < HISTORY_SLOTS; i++) {
+        const HistoryEntry *entry = &history->entries[i];
+        char name[HISTORY_NAME_SIZE];
+        uint32_t tag = __atomic_load_n(&entry->tag, __ATOMIC_ACQUIRE);
+        if (tag == 0 || tag == HISTORY_TAG_BUSY) {
+            continue;
+        }
+        // A copy that is only trusted if nobody started rewriting the slot meanwhile
+        memcpy(name, entry->name, HISTORY_NAME_SIZE);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&entry->tag, __ATOMIC_RELAXED) != tag || name[HISTORY_NAME_SIZE - 1] != '\0') {
+            continue;
+        }
+
+        int first = 0;
+        int matches = index_prefix_range(index, name, &first);
+        if (matches > 0 && strcmp(index_name(index, index->order[first]), name) == 0) {
+            uint32_t score = frecency(entry, now) / HISTORY_BOOST_SCALE;
+            history->boost[index->order[first]] = score < HISTORY_BOOST_MAX ? (int)score : HISTORY_BOOST_MAX;
+        }
+    }
+    return history->boost;
+}
+
+void history_close(History *history) {
+    if (history->map) {
+        munmap(history->map, history->size);
+    }
+    free(history->boost);
+    memset(history, 0, sizeof(*history));
+}
@@ -0,0 +1,51 @@
+#ifndef HISTORY_UTILS_H
+#define HISTORY_UTILS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "index_utils.h"
+
+#define HISTORY_MAGIC 0x48535353    // "SSSH"
+#define HISTORY_VERSION 1
+#define HISTORY_NAME_SIZE 48        // Longer names aren't recorded
+#define HISTORY_PROBE 16            // Slots looked at before evicting the weakest entry
+#define HISTORY_BOOST_SCALE 10      // Frecency points per point of ranking bonus
+#define HISTORY_BOOST_MAX 64        // Cap so history never outweighs about four matched characters
+#define HISTORY_TAG_BUSY 2          // Even, so never a real tag: the slot is being written
+#define HISTORY_BUSY_SPINS 1024     // Loads spent waiting for a busy slot before treating it as taken
+
+// Fixed-size open-addressing table of launches, shared through a MAP_SHARED mapping.
+// A slot is claimed or evicted by swapping its tag to HISTORY_TAG_BUSY, filled in, and published by storing
+// the real tag last; counters are bumped with atomics, so two launchers recording at once never need a lock.
+typedef struct {
+    uint32_t tag;           // Hash of the name with the low bit set, 0 for a free slot, HISTORY_TAG_BUSY while written
+    uint32_t count;         // Number of launches
+    uint32_t last_used;     // Unix time of the latest launch
+    uint32_t reserved;
+    char name[HISTORY_NAME_SIZE];
+} HistoryEntry;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t reserved;
+} HistoryHeader;
+
+typedef struct {
+    void *map;
+    size_t size;
+    HistoryHeader *header;
+    HistoryEntry *entries;
+    int *boost;             // boost[id] -> ranking bonus for index entry id
+    int boost_cap;
+} History;
+
+int history_open(History *history);
+void history_record(History *history, const char *name);
+const int *history_rank(History *history, const ExecIndex *index);
+void history_close(History *history);
+
+#endif
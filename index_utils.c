@@ -0,0 +1,532 @@
+#include "index_utils.h"
+#include "match_utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static const ExecIndex *sort_index;  // Index being sorted by index_merge
+
+// Order by name, then by $PATH position so the directory that would be executed sorts first
+static int compare_ids(const void *a, const void *b) {
+    int id_a = *(const int *)a, id_b = *(const int *)b;
+    int cmp = strcmp(index_name(sort_index, id_a), index_name(sort_index, id_b));
+    if (cmp != 0) {
+        return cmp;
+    }
+    if (sort_index->dir_of[id_a] != sort_index->dir_of[id_b]) {
+        return sort_index->dir_of[id_a] - sort_index->dir_of[id_b];
+    }
+    return id_a - id_b;
+}
+
+// Slot to start probing at for name in dirs[dir]
+static uint32_t lookup_hash(const char *name, size_t len, int dir) {
+    uint32_t hash = 2166136261u ^ (uint32_t)dir;
+
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void lookup_insert(ExecIndex *index, int id) {
+    uint32_t mask = (uint32_t)index->lookup_size - 1;
+    uint32_t slot = lookup_hash(index_name(index, id), index->name_lens[id], index->dir_of[id]) & mask;
+
+    while (index->lookup[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+    index->lookup[slot] = id + 1;
+}
+
+// Fill the lookup table from scratch with every live id, at least size slots. Without memory for it
+// index_find falls back to a linear pass.
+static void lookup_rebuild(ExecIndex *index, int size) {
+    while (size < index->id_count * 2) {
+        size *= 2;
+    }
+    free(index->lookup);
+    index->lookup = calloc(size, sizeof(int));
+    index->lookup_size = index->lookup ? size : 0;
+    for (int id = 0; index->lookup && id < index->id_count; id++) {
+        if (index->dir_of[id] != INDEX_REMOVED) {
+            lookup_insert(index, id);
+        }
+    }
+}
+
+// Copy arrays that still point into the cache file out to the heap, so they can grow and be freed.
+// Returns -1 without memory, the index is left as it was.
+static int index_unmap(ExecIndex *index) {
+    if (!index->map) {
+        return 0;
+    }
+    int cap = index->id_count > 0 ? index->id_count : 1;
+    char *strings = malloc(index->strings_cap);
+    uint32_t *offsets = malloc(sizeof(uint32_t) * cap);
+    uint16_t *name_lens = malloc(sizeof(uint16_t) * cap);
+    uint16_t *dir_of = malloc(sizeof(uint16_t) * cap);
+    uint64_t *char_masks = malloc(sizeof(uint64_t) * cap);
+    int *order = malloc(sizeof(int) * cap);
+    int *lookup = index->lookup ? malloc(sizeof(int) * index->lookup_size) : NULL;
+
+    if (!strings || !offsets || !name_lens || !dir_of || !char_masks || !order || (index->lookup && !lookup)) {
+        free(strings);
+        free(offsets);
+        free(name_lens);
+        free(dir_of);
+        free(char_masks);
+        free(order);
+        free(lookup);
+        return -1;
+    }
+    index->strings = memcpy(strings, index->strings, index->strings_cap);
+    index->offsets = memcpy(offsets, index->offsets, sizeof(uint32_t) * index->id_count);
+    index->name_lens = memcpy(name_lens, index->name_lens, sizeof(uint16_t) * index->id_count);
+    index->dir_of = memcpy(dir_of, index->dir_of, sizeof(uint16_t) * index->id_count);
+    index->char_masks = memcpy(char_masks, index->char_masks, sizeof(uint64_t) * index->id_count);
+    index->order = memcpy(order, index->order, sizeof(int) * index->count);
+    if (lookup) {
+        index->lookup = memcpy(lookup, index->lookup, sizeof(int) * index->lookup_size);
+    }
+    index->capacity = cap;
+    munmap(index->map, index->map_size);
+    index->map = NULL;
+    index->map_size = 0;
+    return 0;
+}
+
+// Make room for count more names taking up size bytes, so adding a whole directory grows the arrays
+// and the lookup table at most once. Returns -1 without memory.
+static int index_reserve(ExecIndex *index, int count, size_t size) {
+    if (index_unmap(index) != 0) {
+        return -1;
+    }
+
+    // Keep zeroed slack after the last name so the matcher can read whole vectors
+    if (index->strings_len + size + INDEX_STRING_PAD > index->strings_cap) {
+        size_t cap = index->strings_cap ? index->strings_cap * 2 : 64 * 1024;
+        while (cap < index->strings_len + size + INDEX_STRING_PAD) {
+            cap *= 2;
+        }
+        char *strings = realloc(index->strings, cap);
+        if (!strings) {
+            return -1;
+        }
+        memset(strings + index->strings_len, 0, cap - index->strings_len);
+        index->strings = strings;
+        index->strings_cap = cap;
+    }
+
+    if (index->id_count + count > index->capacity) {
+        int cap = index->capacity ? index->capacity * 2 : 1024;
+        while (cap < index->id_count + count) {
+            cap *= 2;
+        }
+        uint32_t *offsets = realloc(index->offsets, sizeof(uint32_t) * cap);
+        if (!offsets) {
+            return -1;
+        }
+        index->offsets = offsets;
+        uint16_t *name_lens = realloc(index->name_lens, sizeof(uint16_t) * cap);
+        if (!name_lens) {
+            return -1;
+        }
+        index->name_lens = name_lens;
+        int *order = realloc(index->order, sizeof(int) * cap);
+        if (!order) {
+            return -1;
+        }
+        index->order = order;
+        uint16_t *dir_of = realloc(index->dir_of, sizeof(uint16_t) * cap);
+        if (!dir_of) {
+            return -1;
+        }
+        index->dir_of = dir_of;
+        uint64_t *char_masks = realloc(index->char_masks, sizeof(uint64_t) * cap);
+        if (!char_masks) {
+            return -1;
+        }
+        index->char_masks = char_masks;
+        index->capacity = cap;
+    }
+
+    if ((index->id_count + count) * 2 > index->lookup_size) {
+        int size = index->lookup_size ? index->lookup_size * 2 : 2048;
+        while (size < (index->id_count + count) * 2) {
+            size *= 2;
+        }
+        lookup_rebuild(index, size);
+    }
+    return 0;
+}
+
+// Hand out the next id for a name of len bytes (NUL included), index_reserve made room for it
+static int add_entry(ExecIndex *index, const char *name, size_t len, uint64_t mask, int dir) {
+    memcpy(index->strings + index->strings_len, name, len);
+    index->offsets[index->id_count] = (uint32_t)index->strings_len;
+    index->name_lens[index->id_count] = (uint16_t)(len - 1);
+    index->dir_of[index->id_count] = (uint16_t)dir;
+    index->char_masks[index->id_count] = mask;
+    index->strings_len += len;
+    index->order[index->count++] = index->id_count;
+    if (dir < index->dir_count) {
+        index->dirs[dir].name_count++;
+    }
+    int id = index->id_count++;
+    index->scattered = 1;
+    if (index->lookup) {
+        lookup_insert(index, id);
+    }
+    return id;
+}
+
+// Append a name found in dirs[dir] to the string table and hand out a new id for it
+int index_add(ExecIndex *index, const char *name, int dir) {
+    size_t len = strlen(name) + 1;
+
+    if (index_reserve(index, 1, len) != 0) {
+        return -1;
+    }
+    return add_entry(index, name, len, char_mask(name), dir);
+}
+
+// Hand the ids out again in sorted order, the shadowed duplicates after them, and drop removed entries.
+// The per-id arrays and the string table are rewritten to match, so a scan over `order` walks all of
+// them forwards instead of jumping around by id. Without removed entries the lookup table keeps its
+// layout and only has its ids renamed, nothing is hashed again.
+static void index_compact(ExecIndex *index) {
+    char *strings = malloc(index->strings_cap);
+    uint32_t *offsets = malloc(sizeof(uint32_t) * index->capacity);
+    uint16_t *name_lens = malloc(sizeof(uint16_t) * index->capacity);
+    uint16_t *dir_of = malloc(sizeof(uint16_t) * index->capacity);
+    uint64_t *char_masks = malloc(sizeof(uint64_t) * index->capacity);
+    int *placed = calloc(index->id_count > 0 ? index->id_count : 1, sizeof(int));  // placed[id] -> new id + 1
+    size_t len = 0;
+    int live = 0;
+
+    if (!strings || !offsets || !name_lens || !dir_of || !char_masks || !placed) {
+        free(strings);
+        free(offsets);
+        free(name_lens);
+        free(dir_of);
+        free(char_masks);
+        free(placed);
+        return;
+    }
+
+    // The sorted entries first, then whatever they shadow
+    for (int pass = 0; pass < 2; pass++) {
+        int end = pass == 0 ? index->count : index->id_count;
+        for (int i = 0; i < end; i++) {
+            int id = pass == 0 ? index->order[i] : i;
+            if (placed[id] || index->dir_of[id] == INDEX_REMOVED) {
+                continue;
+            }
+            placed[id] = live + 1;
+            offsets[live] = (uint32_t)len;
+            name_lens[live] = index->name_lens[id];
+            dir_of[live] = index->dir_of[id];
+            char_masks[live] = index->char_masks[id];
+            memcpy(strings + len, index_name(index, id), index->name_lens[id] + 1);
+            len += index->name_lens[id] + 1;
+            live++;
+        }
+    }
+    memset(strings + len, 0, index->strings_cap - len);
+
+    free(index->strings);
+    free(index->offsets);
+    free(index->name_lens);
+    free(index->dir_of);
+    free(index->char_masks);
+    index->strings = strings;
+    index->strings_len = len;
+    index->offsets = offsets;
+    index->name_lens = name_lens;
+    index->dir_of = dir_of;
+    index->char_masks = char_masks;
+    for (int i = 0; i < index->count; i++) {
+        index->order[i] = i;
+    }
+    int kept_all = live == index->id_count;
+    index->id_count = live;
+    if (kept_all && index->lookup) {
+        for (int slot = 0; slot < index->lookup_size; slot++) {
+            if (index->lookup[slot] != 0) {
+                index->lookup[slot] = placed[index->lookup[slot] - 1];
+            }
+        }
+    } else {
+        lookup_rebuild(index, 2048);
+    }
+    free(placed);
+    index->sorted = index->count;
+    index->scattered = 0;
+}
+
+// Id of the live entry for name in dirs[dir], -1 if there is none
+int index_find(const ExecIndex *index, const char *name, int dir) {
+    size_t len = strlen(name);
+
+    if (index->lookup) {
+        // Removed entries stay in the table until the next index_finalize, their dir no longer matches
+        uint32_t mask = (uint32_t)index->lookup_size - 1;
+        for (uint32_t slot = lookup_hash(name, len, dir) & mask; index->lookup[slot] != 0; slot = (slot + 1) & mask) {
+            int id = index->lookup[slot] - 1;
+            if (index->dir_of[id] == dir && index->name_lens[id] == len && memcmp(index_name(index, id), name, len) == 0) {
+                return id;
+            }
+        }
+        return -1;
+    }
+    for (int id = 0; id < index->id_count; id++) {
+        if (index->dir_of[id] == dir && index->name_lens[id] == len && memcmp(index_name(index, id), name, len) == 0) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+// Drop an entry. Its id stays unused until index_finalize hands out new ones, index_merge brings back any copy it was shadowing.
+void index_remove(ExecIndex *index, int id) {
+    int dir = index->dir_of[id];
+
+    if (dir == INDEX_REMOVED || index_unmap(index) != 0) {
+        return;
+    }
+    if (dir < index->dir_count) {
+        index->dirs[dir].name_count--;
+    }
+    index->dir_of[id] = INDEX_REMOVED;
+    index->removed++;
+    index->scattered = 1;
+}
+
+// Take removed entries out of order. What is left of the sorted part stays sorted, every other live id
+// (new ones, and shadowed copies that may take a removed entry's place) is pending for the merge.
+static void drop_removed(ExecIndex *index) {
+    unsigned char *in_order = calloc(index->id_count > 0 ? index->id_count : 1, 1);
+    int kept = 0;
+
+    // Without memory for the marks, everything goes through the merge
+    for (int i = 0; in_order && i < index->sorted; i++) {
+        int id = index->order[i];
+        in_order[id] = 1;
+        if (index->dir_of[id] != INDEX_REMOVED) {
+            index->order[kept++] = id;
+        }
+    }
+    index->sorted = kept;
+    index->count = kept;
+    for (int id = 0; id < index->id_count; id++) {
+        if (index->dir_of[id] != INDEX_REMOVED && !(in_order && in_order[id])) {
+            index->order[index->count++] = id;
+        }
+    }
+    index->removed = 0;
+    free(in_order);
+}
+
+// First entry in order[lo, hi) whose name is not less than the name of id. Steps forwards from lo in
+// growing strides first, as the pending entries are sorted too and each one tends to land close to the last.
+static int order_lower_bound(const ExecIndex *index, int lo, int hi, int id) {
+    const char *name = index_name(index, id);
+    int step = 1;
+
+    while (lo + step - 1 < hi && strcmp(index_name(index, index->order[lo + step - 1]), name) < 0) {
+        lo += step;
+        step *= 2;
+    }
+    if (lo + step - 1 < hi) {
+        hi = lo + step - 1;
+    }
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strcmp(index_name(index, index->order[mid]), name) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Fold the pending entries at the end of order into the sorted part, dropping duplicates (the earliest
+// $PATH directory wins). Ids don't change. A directory's names usually arrive sorted already, then this is
+// a binary search per new entry and a copy of the rest, rather than sorting the whole index again.
+void index_merge(ExecIndex *index) {
+    if (index->removed) {
+        drop_removed(index);
+    }
+    int *pending = index->order + index->sorted;
+    int pending_count = index->count - index->sorted;
+    if (pending_count == 0) {
+        return;
+    }
+
+    sort_index = index;
+    for (int i = 1; i < pending_count; i++) {
+        if (compare_ids(&pending[i - 1], &pending[i]) > 0) {
+            qsort(pending, pending_count, sizeof(int), compare_ids);
+            break;
+        }
+    }
+
+    int *merged = malloc(sizeof(int) * (index->capacity > 0 ? index->capacity : 1));
+    if (!merged) {
+        // Sort everything in place instead
+        qsort(index->order, index->count, sizeof(int), compare_ids);
+        sort_index = NULL;
+        int kept = 1;
+        for (int i = 1; i < index->count; i++) {
+            int id = index->order[i];
+            if (strcmp(index_name(index, id), index_name(index, index->order[kept - 1])) != 0) {
+                index->order[kept++] = id;
+            }
+        }
+        index->count = kept;
+        index->sorted = kept;
+        return;
+    }
+
+    int count = 0, next = 0;
+    for (int i = 0; i < pending_count; i++) {
+        int id = pending[i];
+        // A later directory's copy of the name just before, which won or lost already
+        if (i > 0 && index->name_lens[id] == index->name_lens[pending[i - 1]] &&
+            strcmp(index_name(index, id), index_name(index, pending[i - 1])) == 0) {
+            continue;
+        }
+
+        int at = order_lower_bound(index, next, index->sorted, id);
+        memcpy(merged + count, index->order + next, sizeof(int) * (at - next));
+        count += at - next;
+        next = at;
+        if (at < index->sorted && strcmp(index_name(index, index->order[at]), index_name(index, id)) == 0) {
+            // Same name already in order, keep whichever comes first in $PATH
+            if (compare_ids(&id, &index->order[at]) > 0) {
+                id = index->order[at];
+            }
+            next++;
+        }
+        merged[count++] = id;
+    }
+    sort_index = NULL;
+    memcpy(merged + count, index->order + next, sizeof(int) * (index->sorted - next));
+    count += index->sorted - next;
+
+    free(index->order);
+    index->order = merged;
+    index->count = count;
+    index->sorted = count;
+}
+
+// Merge the pending entries and hand the ids out again in sorted order.
+// Every id may change, so anything keyed by id has to be rebuilt afterwards.
+void index_finalize(ExecIndex *index) {
+    index_merge(index);
+    if (index->scattered) {
+        index_compact(index);
+    }
+}
+
+// Add a block of NUL-separated names, as produced by a directory scan or stored in the cache.
+// masks holds their char_mask() if the caller has them already, or is NULL.
+int index_add_names(ExecIndex *index, const char *names, size_t size, const uint64_t *masks, int dir) {
+    const char *end = names + size;
+    int count = 0;
+
+    for (const char *name = names; name < end; name += strlen(name) + 1) {
+        count++;
+    }
+    if (index_reserve(index, count, size) != 0) {
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(names) + 1;
+        add_entry(index, names, len, masks ? masks[i] : char_mask(names), dir);
+        names += len;
+    }
+    return count;
+}
+
+// Add the entries [first, end) of another index whose directory dir_map[] maps to one of ours, -1 skips it.
+// Their masks come along, so taking over what a cached index still has right costs no more than a copy.
+// Returns the number added.
+int index_add_entries(ExecIndex *index, const ExecIndex *from, int first, int end, const int *dir_map) {
+    int count = 0;
+    size_t size = 0;
+
+    for (int id = first; id < end; id++) {
+        if (from->dir_of[id] < from->dir_count && dir_map[from->dir_of[id]] >= 0) {
+            count++;
+            size += from->name_lens[id] + 1;
+        }
+    }
+    if (index_reserve(index, count, size) != 0) {
+        return 0;
+    }
+    for (int id = first; id < end; id++) {
+        if (from->dir_of[id] < from->dir_count && dir_map[from->dir_of[id]] >= 0) {
+            add_entry(index, index_name(from, id), from->name_lens[id] + 1, from->char_masks[id], dir_map[from->dir_of[id]]);
+        }
+    }
+    return count;
+}
+
+// Narrow a block of sorted entries [*first, *first + count) to those starting with prefix.
+// Returns the number of matches and stores the position of the first in *first.
+int index_narrow_range(const ExecIndex *index, const char *prefix, int *first, int count) {
+    size_t prefix_len = strlen(prefix);
+    int lo = *first, hi = *first + count, end = hi;
+
+    // Lower bound: first entry whose prefix is not less than the query
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strncmp(index_name(index, index->order[mid]), prefix, prefix_len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *first = lo;
+
+    // Upper bound: first entry whose prefix is greater than the query
+    hi = end;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strncmp(index_name(index, index->order[mid]), prefix, prefix_len) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - *first;
+}
+
+// Find the block of sorted entries starting with prefix
+int index_prefix_range(const ExecIndex *index, const char *prefix, int *first) {
+    *first = 0;
+    return index_narrow_range(index, prefix, first, index->count);
+}
+
+void index_free(ExecIndex *index) {
+    for (int i = 0; i < index->dir_count; i++) {
+        free(index->dirs[i].path);
+    }
+    free(index->dirs);
+    if (index->map) {
+        munmap(index->map, index->map_size);
+    } else {
+        free(index->strings);
+        free(index->offsets);
+        free(index->name_lens);
+        free(index->order);
+        free(index->dir_of);
+        free(index->char_masks);
+        free(index->lookup);
+    }
+    memset(index, 0, sizeof(*index));
+}
@@ -0,0 +1,67 @@
+#ifndef INDEX_UTILS_H
+#define INDEX_UTILS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define INDEX_STRING_PAD 32          // Readable zero bytes kept after the last name
+#define INDEX_REMOVED UINT16_MAX     // dir_of value of an entry that has gone from disk
+
+// One $PATH directory and how many executables were found in it
+typedef struct {
+    char *path;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int name_count;
+} IndexDir;
+
+// Resident table of every executable name found in $PATH.
+// Names live back to back in one string table and are addressed by id;
+// `order` keeps the ids sorted by name so prefix queries are a binary search.
+// index_merge folds new entries into `order` without touching ids, which is cheap enough to do
+// after every directory of a scan. index_finalize then hands the ids out again in sorted order and
+// rewrites the string table to match, so scans over `order` walk memory forwards and removed entries take up no room.
+typedef struct {
+    char *strings;          // Contiguous NUL-terminated names
+    size_t strings_len;
+    size_t strings_cap;
+    uint32_t *offsets;      // offsets[id] -> start of the name in strings
+    uint16_t *name_lens;    // name_lens[id] -> length of the name
+    uint16_t *dir_of;       // dir_of[id] -> entry in dirs the name was found in, or INDEX_REMOVED
+    uint64_t *char_masks;   // char_masks[id] -> characters present in the name, see char_mask()
+    int *order;             // Ids sorted by name, without duplicates
+    int count;              // Number of entries in order
+    int sorted;             // Entries at the front of order already sorted and deduplicated, the rest are pending
+    int id_count;           // Number of ids handed out
+    int capacity;
+    int removed;            // Entries removed since the last merge, which then takes them out of order
+    int scattered;          // Ids no longer follow name order, or removed ones still take up room
+    int *lookup;            // Open-addressed (name, dir) -> id + 1, 0 for an empty slot
+    int lookup_size;        // Power of two, kept at least twice id_count
+    IndexDir *dirs;         // $PATH directories in lookup order
+    int dir_count;
+    void *map;              // Cache file the arrays point into, until the first change copies them out
+    size_t map_size;
+} ExecIndex;
+
+int index_add(ExecIndex *index, const char *name, int dir);
+int index_add_names(ExecIndex *index, const char *names, size_t size, const uint64_t *masks, int dir);
+int index_add_entries(ExecIndex *index, const ExecIndex *from, int first, int end, const int *dir_map);
+int index_find(const ExecIndex *index, const char *name, int dir);
+void index_remove(ExecIndex *index, int id);
+void index_merge(ExecIndex *index);
+void index_finalize(ExecIndex *index);
+int index_narrow_range(const ExecIndex *index, const char *prefix, int *first, int count);
+int index_prefix_range(const ExecIndex *index, const char *prefix, int *first);
+void index_free(ExecIndex *index);
+
+// Name of the entry with the given id
+static inline const char *index_name(const ExecIndex *index, int id) {
+    return index->strings + index->offsets[id];
+}
+
+static inline int index_name_len(const ExecIndex *index, int id) {
+    return index->name_lens[id];
+}
+
+#endif
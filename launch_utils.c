@@ -0,0 +1,102 @@
+#define _GNU_SOURCE  // POSIX_SPAWN_SETSID
+
+#include "launch_utils.h"
+#include "config.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+
+extern char **environ;
+
+// Start a program in its own session with default signal handling, without waiting for it
+static int spawn_detached(const char *file, char *const argv[], int search_path) {
+    posix_spawnattr_t attr;
+    sigset_t signals;
+    pid_t pid;
+
+    posix_spawnattr_init(&attr);
+
+    // A resident launcher ignores SIGCHLD, the program shouldn't inherit that or our mask
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigaddset(&signals, SIGCHLD);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    int err = search_path ? posix_spawnp(&pid, file, NULL, &attr, argv, environ)
+                          : posix_spawn(&pid, file, NULL, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    return err;
+}
+
+// Find the id of an executable called exactly `name`, -1 if the index doesn't have one
+static int lookup_id(const ExecIndex *index, const char *name) {
+    int first;
+    if (index_prefix_range(index, name, &first) == 0) {
+        return -1;
+    }
+    // Sorted by name, so an exact match comes before every longer name sharing the prefix
+    int id = index->order[first];
+    return (size_t)index_name_len(index, id) == strlen(name) ? id : -1;
+}
+
+// Run a command line, exec'ing the binary from the index directly unless it needs a shell.
+// `id` is the index entry of the first word when it is already known, -1 otherwise.
+int launch_command(const ExecIndex *index, int id, const char *cmd) {
+    char line[MAX_INPUT_LENGTH];
+    char *argv[LAUNCH_MAX_ARGS + 1];
+    int argc = 0;
+
+    int simple = strpbrk(cmd, LAUNCH_SHELL_CHARS) == NULL && strlen(cmd) < sizeof(line);
+    if (simple) {
+        // Split on blanks, which is all the shell would have done with this line
+        strcpy(line, cmd);
+        char *save = NULL;
+        for (char *word = strtok_r(line, " \t", &save); word; word = strtok_r(NULL, " \t", &save)) {
+            if (argc == LAUNCH_MAX_ARGS) {
+                simple = 0;
+                break;
+            }
+            argv[argc++] = word;
+        }
+        argv[argc] = NULL;
+        // A leading NAME=value assigns a variable for the shell to export
+        simple = simple && argc > 0 && strchr(argv[0], '=') == NULL;
+    }
+
+    if (!simple) {
+        char *shell_argv[] = { "sh", "-c", (char *)cmd, NULL };
+        int err = spawn_detached(LAUNCH_SHELL, shell_argv, 0);
+        if (err != 0) {
+            fprintf(stderr, "Unable to run %s: %s\n", LAUNCH_SHELL, strerror(err));
+            return -1;
+        }
+        return 0;
+    }
+
+    // Use the path the index already resolved instead of searching $PATH again
+    if (strchr(argv[0], '/') == NULL) {
+        if (id < 0 || strcmp(index_name(index, id), argv[0]) != 0) {
+            id = lookup_id(index, argv[0]);
+        }
+        if (id >= 0 && index->dir_of[id] < index->dir_count) {
+            char path[PATH_MAX];
+            int len = snprintf(path, sizeof(path), "%s/%s", index->dirs[index->dir_of[id]].path, argv[0]);
+            if (len > 0 && (size_t)len < sizeof(path) && spawn_detached(path, argv, 0) == 0) {
+                return 0;
+            }
+            // Removed or replaced since the scan, let $PATH have the final say
+        }
+    }
+
+    int err = spawn_detached(argv[0], argv, 1);
+    if (err != 0) {
+        fprintf(stderr, "Unable to run %s: %s\n", argv[0], strerror(err));
+        return -1;
+    }
+    return 0;
+}
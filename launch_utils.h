@@ -0,0 +1,14 @@
+#ifndef LAUNCH_UTILS_H
+#define LAUNCH_UTILS_H
+
+#include "index_utils.h"
+
+#define LAUNCH_MAX_ARGS 64          // More words than this go through the shell
+#define LAUNCH_SHELL "/bin/sh"
+
+// Characters that need a shell to mean what the user typed
+#define LAUNCH_SHELL_CHARS "|&;<>()$`\\\"'*?[]#~{}!\n"
+
+int launch_command(const ExecIndex *index, int id, const char *cmd);
+
+#endif
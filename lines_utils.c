@@ -0,0 +1,459 @@
+#define _GNU_SOURCE  // memmem()
+
+#include "lines_utils.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// One search split into FILTER_CHUNK sized pieces that threads claim in turn.
+// Candidate k is out[k] for k < prev_count, a line from first_line onwards after that.
+typedef struct {
+    const LineInput *lines;
+    const char *query;
+    int query_len;
+    uint64_t query_mask;
+    int fuzzy;
+    int *out;               // Matches are written back over the candidates they came from
+    int prev_count;
+    int first_line;
+    int total;
+    int *chunk_counts;
+    atomic_int next_chunk;
+    SearchCancel *cancel;   // Checked before every chunk, may be NULL
+    unsigned generation;
+    atomic_int stopped;     // Some thread gave up on a chunk for newer input
+} FilterJob;
+
+typedef struct {
+    FilterJob *job;
+    MatchHeap heap;
+    pthread_t thread;
+} FilterWorker;
+
+// Map a regular file, or set up a read buffer for anything else
+int lines_open(LineInput *lines, int fd) {
+    struct stat st;
+
+    memset(lines, 0, sizeof(*lines));
+    lines->fd = fd;
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        // Reserve zeroed pages for the padding, then put the file over the front of them
+        long page = sysconf(_SC_PAGESIZE);
+        size_t size = st.st_size;
+        size_t cap = (size + INDEX_STRING_PAD + page - 1) & ~(size_t)(page - 1);
+        void *base = mmap(NULL, cap, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base != MAP_FAILED) {
+            if (mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED) {
+                madvise(base, size, MADV_WILLNEED);
+                lines->data = base;
+                lines->size = size;
+                lines->cap = cap;
+                lines->mapped = 1;
+                return 0;
+            }
+            munmap(base, cap);
+        }
+    }
+
+    lines->cap = LINES_CHUNK + INDEX_STRING_PAD;
+    lines->data = calloc(lines->cap, 1);
+    return lines->data ? 0 : -1;
+}
+
+// Make room for one more line
+static int lines_grow(LineInput *lines) {
+    int capacity = lines->capacity ? lines->capacity * 2 : 65536;
+    size_t *offsets = realloc(lines->offsets, sizeof(size_t) * capacity);
+    if (offsets) {
+        lines->offsets = offsets;
+    }
+    uint32_t *lens = realloc(lines->lens, sizeof(uint32_t) * capacity);
+    if (lens) {
+        lines->lens = lens;
+    }
+    uint64_t *char_masks = realloc(lines->char_masks, sizeof(uint64_t) * capacity);
+    if (char_masks) {
+        lines->char_masks = char_masks;
+    }
+    if (!offsets || !lens || !char_masks) {
+        return -1;
+    }
+    lines->capacity = capacity;
+    return 0;
+}
+
+// Record every complete line in data[split, end), plus the unterminated rest once the input has ended
+static int lines_split(LineInput *lines, size_t end) {
+    int added = 0;
+
+    while (lines->split < end) {
+        const char *start = lines->data + lines->split;
+        const char *newline = memchr(start, '\n', end - lines->split);
+        size_t len = newline ? (size_t)(newline - start) : end - lines->split;
+        if (!newline && !lines->eof) {
+            break;
+        }
+        if (lines->count == lines->capacity && lines_grow(lines) != 0) {
+            break;
+        }
+        lines->offsets[lines->count] = lines->split;
+        lines->lens[lines->count] = len < UINT32_MAX ? len : UINT32_MAX;
+        lines->char_masks[lines->count] = char_mask_n(start, len);
+        lines->count++;
+        added++;
+        lines->split += len + 1;
+    }
+    if (lines->split > end) {
+        lines->split = end;
+    }
+    return added;
+}
+
+// Take in the next piece of input: split another LINES_CHUNK of the mapping, or do one read() from the pipe.
+// Returns the number of lines added, lines->eof is set once everything has been seen.
+int lines_read(LineInput *lines) {
+    if (lines->eof) {
+        return 0;
+    }
+
+    if (lines->mapped) {
+        size_t end = lines->split + LINES_CHUNK < lines->size ? lines->split + LINES_CHUNK : lines->size;
+        if (end == lines->size) {
+            lines->eof = 1;
+        } else {
+            // Finish the line the chunk ends in
+            const char *newline = memchr(lines->data + end, '\n', lines->size - end);
+            end = newline ? (size_t)(newline - lines->data) + 1 : lines->size;
+            lines->eof = end == lines->size;
+        }
+        return lines_split(lines, end);
+    }
+
+    if (lines->size + LINES_CHUNK + INDEX_STRING_PAD > lines->cap) {
+        size_t cap = lines->cap * 2;
+        char *data = realloc(lines->data, cap);
+        if (!data) {
+            lines->eof = 1;
+            return lines_split(lines, lines->size);
+        }
+        lines->data = data;
+        lines->cap = cap;
+    }
+
+    ssize_t got = read(lines->fd, lines->data + lines->size, LINES_CHUNK);
+    if (got > 0) {
+        lines->size += got;
+    } else {
+        lines->eof = 1;
+    }
+    // Keep the padding zeroed behind whatever arrived
+    memset(lines->data + lines->size, 0, INDEX_STRING_PAD);
+    return lines_split(lines, lines->size);
+}
+
+// Score a line against the query, -1 if it doesn't match. Without fuzzy matching it is dmenu's
+// substring match, ranking exact matches first, then prefixes, then the rest.
+static int line_score(const FilterJob *job, int line) {
+    const LineInput *lines = job->lines;
+
+    if (job->query_mask & ~lines->char_masks[line]) {
+        return -1;
+    }
+    const char *text = lines_text(lines, line);
+    size_t len = lines_len(lines, line);
+    if (job->fuzzy) {
+        return fuzzy_score(text, len, job->query, job->query_len);
+    }
+    if (len < (size_t)job->query_len) {
+        return -1;
+    }
+    if (memcmp(text, job->query, job->query_len) == 0) {
+        return len == (size_t)job->query_len ? 2 : 1;
+    }
+    return memmem(text + 1, len - 1, job->query, job->query_len) ? 0 : -1;
+}
+
+static void *filter_worker(void *arg) {
+    FilterWorker *worker = arg;
+    FilterJob *job = worker->job;
+
+    for (;;) {
+        int chunk = atomic_fetch_add_explicit(&job->next_chunk, 1, memory_order_relaxed);
+        int first = chunk * FILTER_CHUNK;
+        if (first >= job->total) {
+            break;
+        }
+        if (search_cancelled(job->cancel, job->generation)) {
+            atomic_store_explicit(&job->stopped, 1, memory_order_relaxed);
+            break;
+        }
+        int last = first + FILTER_CHUNK < job->total ? first + FILTER_CHUNK : job->total;
+
+        // Matches never outnumber the candidates read so far, so they can overwrite them
+        int written = first;
+        for (int k = first; k < last; k++) {
+            int line = k < job->prev_count ? job->out[k] : job->first_line + (k - job->prev_count);
+            int score = line_score(job, line);
+            if (score >= 0) {
+                job->out[written++] = line;
+                heap_push(&worker->heap, line, score, line);
+            }
+        }
+        job->chunk_counts[chunk] = written - first;
+    }
+    return NULL;
+}
+
+// Filter job->total candidates across up to FILTER_THREADS threads and fold their best matches into heap.
+// Returns the number of matches, packed at the front of job->out in input order, or -1 if job->cancel
+// stopped it with job->out partly overwritten.
+static int filter_run(FilterJob *job, MatchHeap *heap) {
+    FilterWorker workers[FILTER_THREADS];
+    int thread_count = 1;
+
+    if (job->total >= FILTER_PARALLEL_MIN) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = cpus > 0 && cpus < FILTER_THREADS ? (int)cpus : FILTER_THREADS;
+    }
+
+    atomic_init(&job->next_chunk, 0);
+    atomic_init(&job->stopped, 0);
+    job->generation = search_generation(job->cancel);
+    for (int i = 0; i < thread_count; i++) {
+        workers[i].job = job;
+        workers[i].heap.count = 0;
+    }
+    // This thread takes part too, helpers that fail to start just leave it more chunks
+    int started = 1;
+    for (int i = 1; i < thread_count; i++) {
+        if (pthread_create(&workers[started].thread, NULL, filter_worker, &workers[started]) == 0) {
+            started++;
+        }
+    }
+    filter_worker(&workers[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    if (atomic_load_explicit(&job->stopped, memory_order_relaxed)) {
+        return -1;
+    }
+
+    for (int i = 0; i < started; i++) {
+        for (int j = 0; j < workers[i].heap.count; j++) {
+            const ScoredMatch *match = &workers[i].heap.items[j];
+            heap_push(heap, match->id, match->score, match->rank);
+        }
+    }
+
+    int matched = 0;
+    int chunks = (job->total + FILTER_CHUNK - 1) / FILTER_CHUNK;
+    for (int chunk = 0; chunk < chunks; chunk++) {
+        memmove(job->out + matched, job->out + chunk * FILTER_CHUNK, sizeof(int) * job->chunk_counts[chunk]);
+        matched += job->chunk_counts[chunk];
+    }
+    return matched;
+}
+
+// Make sure the match and chunk buffers hold a search over total candidates, they only ever grow
+static int lines_reserve(LineInput *lines, int matches, int total) {
+    if (matches > lines->match_cap) {
+        int cap = lines->match_cap ? lines->match_cap : 65536;
+        while (cap < matches) {
+            cap *= 2;
+        }
+        int *buffer = realloc(lines->matches, sizeof(int) * cap);
+        if (!buffer) {
+            return -1;
+        }
+        lines->matches = buffer;
+        lines->match_cap = cap;
+    }
+    int chunks = (total + FILTER_CHUNK - 1) / FILTER_CHUNK;
+    if (chunks > lines->chunk_cap) {
+        int *counts = realloc(lines->chunk_counts, sizeof(int) * chunks);
+        if (!counts) {
+            return -1;
+        }
+        lines->chunk_counts = counts;
+        lines->chunk_cap = chunks;
+    }
+    return 0;
+}
+
+// Search the lines read so far and fill in the first page. The same query again only filters lines that
+// arrived since, a longer one only refilters the previous matches. Items point into lines->shown until the
+// next search or page. Returns -1 if cancel stopped it for newer input, lines->shown is left alone then.
+int lines_search(LineInput *lines, int fuzzy, const char *query, ResultList *result_list, SearchCancel *cancel) {
+    int query_len = strlen(query);
+
+    result_list->count = 0;
+    result_list->selected = 0;
+    result_list->offset = 0;
+    result_list->total = 0;
+    lines->ranked_valid = 0;
+    if (query_len >= MAX_INPUT_LENGTH) {
+        return 0;
+    }
+
+    if (query_len == 0) {
+        // Nothing typed yet, every line in input order
+        lines->valid = 0;
+        lines->query[0] = '\0';
+    } else {
+        int same = lines->valid && lines->fuzzy == fuzzy && strcmp(lines->query, query) == 0;
+        int previous_len = strlen(lines->query);
+        int narrower = !same && lines->valid && lines->fuzzy == fuzzy && previous_len > 0 &&
+                       strncmp(lines->query, query, previous_len) == 0;
+
+        FilterJob job = {
+            .lines = lines,
+            .query = query,
+            .query_len = query_len,
+            .query_mask = char_mask(query),
+            .fuzzy = fuzzy,
+            .cancel = cancel,
+        };
+        MatchHeap heap = {0};
+        int kept = 0;
+        if (same) {
+            // Earlier matches stand, only the new lines go after them
+            kept = lines->match_count;
+            heap = lines->heap;
+            job.first_line = lines->searched;
+        } else if (narrower) {
+            job.prev_count = lines->match_count;
+            job.first_line = lines->searched;
+        }
+        job.total = job.prev_count + (lines->count - job.first_line);
+
+        if (lines_reserve(lines, kept + job.total, job.total) != 0) {
+            return 0;
+        }
+        job.out = lines->matches + kept;
+        job.chunk_counts = lines->chunk_counts;
+        int matched = filter_run(&job, &heap);
+        if (matched < 0) {
+            // The earlier matches were partly overwritten, the next search starts from all lines
+            lines->valid = 0;
+            return -1;
+        }
+        lines->match_count = kept + matched;
+        lines->searched = lines->count;
+        lines->heap = heap;
+        lines->fuzzy = fuzzy;
+        lines->valid = 1;
+        memcpy(lines->query, query, query_len + 1);
+    }
+    return lines_page(lines, 0, result_list);
+}
+
+// Score every match of the last search as the search scored it
+static int lines_score(LineInput *lines) {
+    FilterJob job = {
+        .lines = lines,
+        .query = lines->query,
+        .query_len = strlen(lines->query),
+        .query_mask = char_mask(lines->query),
+        .fuzzy = lines->fuzzy,
+    };
+    int count = lines->match_count;
+
+    if (count > lines->ranked_cap) {
+        ScoredMatch *ranked = realloc(lines->ranked, sizeof(ScoredMatch) * count);
+        if (!ranked) {
+            return -1;
+        }
+        lines->ranked = ranked;
+        lines->ranked_cap = count;
+    }
+    for (int i = 0; i < count; i++) {
+        int line = lines->matches[i];
+        lines->ranked[i] = (ScoredMatch){ line, line_score(&job, line), line };
+    }
+    lines->ranked_sorted = 0;
+    lines->ranked_valid = 1;
+    return 0;
+}
+
+// Fill result_list with the last search's results from rank offset on. Without a query that is a run of
+// lines and the first page of matches was kept by the search; past that every match is scored once per
+// search and only ranked as deep as the pages asked for.
+int lines_page(LineInput *lines, int offset, ResultList *result_list) {
+    int page[MAX_RESULTS];
+    int count = 0;
+
+    result_list->count = 0;
+    result_list->selected = 0;
+    result_list->offset = 0;
+    result_list->total = 0;
+
+    int total = lines->query[0] == '\0' ? lines->count : lines->valid ? lines->match_count : 0;
+    if (total <= 0) {
+        return 0;
+    }
+    if (offset > total - 1) {
+        offset = total - 1;
+    }
+    if (offset < 0) {
+        offset = 0;
+    }
+
+    if (lines->query[0] == '\0') {
+        for (int line = offset; line < total && count < MAX_RESULTS; line++) {
+            page[count++] = line;
+        }
+    } else if (offset == 0) {
+        MatchHeap heap = lines->heap;
+        heap_sort(&heap);
+        for (int i = 0; i < heap.count; i++) {
+            page[count++] = heap.items[i].id;
+        }
+    } else {
+        if (!lines->ranked_valid && lines_score(lines) != 0) {
+            return 0;
+        }
+        lines->ranked_sorted = match_rank(lines->ranked, total, lines->ranked_sorted, offset + MAX_RESULTS);
+        for (int i = offset; i < lines->ranked_sorted && count < MAX_RESULTS; i++) {
+            page[count++] = lines->ranked[i].id;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        size_t len = lines_len(lines, page[i]);
+        if (len >= MAX_INPUT_LENGTH) {
+            len = MAX_INPUT_LENGTH - 1;
+        }
+        memcpy(lines->shown[i], lines_text(lines, page[i]), len);
+        lines->shown[i][len] = '\0';
+        result_list->ids[i] = page[i];
+        result_list->items[i] = lines->shown[i];
+    }
+    result_list->count = count;
+    result_list->offset = offset;
+    result_list->total = total;
+    return count;
+}
+
+void lines_close(LineInput *lines) {
+    if (lines->mapped) {
+        munmap(lines->data, lines->cap);
+    } else {
+        free(lines->data);
+    }
+    free(lines->offsets);
+    free(lines->lens);
+    free(lines->char_masks);
+    free(lines->matches);
+    free(lines->chunk_counts);
+    free(lines->ranked);
+    memset(lines, 0, sizeof(*lines));
+}
@@ -0,0 +1,65 @@
+#ifndef LINES_UTILS_H
+#define LINES_UTILS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "path_utils.h"
+#include "match_utils.h"
+
+#define LINES_CHUNK (4 << 20)       // Bytes read or split into lines per call to lines_read
+#define FILTER_CHUNK 16384          // Candidates a filter thread claims at a time
+
+// Candidate lines from stdin for the dmenu-style mode (-s).
+// A regular file is mapped as is and a pipe is read into one growing buffer; lines are never copied,
+// they are addressed by offset and end at their newline. At least INDEX_STRING_PAD zero bytes follow
+// the input, like the index's string table, so the fuzzy matcher's vector loads stay inside it.
+typedef struct {
+    char *data;
+    size_t size;            // Bytes of input so far
+    size_t cap;             // Bytes mapped or allocated, padding included
+    size_t split;           // Bytes already split into lines
+    int mapped;             // data is a mapping of fd rather than a read buffer
+    int fd;
+    int eof;
+    size_t *offsets;        // offsets[line] -> first byte of the line in data
+    uint32_t *lens;         // lens[line] -> length without the newline
+    uint64_t *char_masks;   // char_masks[line] -> characters present in the line, see char_mask()
+    int count;
+    int capacity;
+
+    // Last search, so a longer query or more input only filters what could still change
+    char query[MAX_INPUT_LENGTH];
+    int fuzzy;
+    int valid;
+    int *matches;           // Matching lines in input order
+    int match_count;
+    int match_cap;
+    int searched;           // Lines [0, searched) have been filtered against query
+    int *chunk_counts;      // Matches per FILTER_CHUNK candidates, while filtering
+    int chunk_cap;
+    MatchHeap heap;         // Best matches of the last search, still in heap order
+    ScoredMatch *ranked;    // Every match, scored once a page past the first is asked for
+    int ranked_sorted;      // ranked[0, ranked_sorted) are the best, in order
+    int ranked_cap;
+    int ranked_valid;
+    char shown[MAX_RESULTS][MAX_INPUT_LENGTH];  // NUL-terminated copies of the page's lines for drawing
+} LineInput;
+
+int lines_open(LineInput *lines, int fd);
+int lines_read(LineInput *lines);
+int lines_search(LineInput *lines, int fuzzy, const char *query, ResultList *result_list, SearchCancel *cancel);
+int lines_page(LineInput *lines, int offset, ResultList *result_list);
+void lines_close(LineInput *lines);
+
+// Text of a line, not NUL-terminated
+static inline const char *lines_text(const LineInput *lines, int line) {
+    return lines->data + lines->offsets[line];
+}
+
+static inline size_t lines_len(const LineInput *lines, int line) {
+    return lines->lens[line];
+}
+
+#endif
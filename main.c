@@ -3,23 +3,42 @@
 #include <X11/keysym.h>
 #include <X11/Xft/Xft.h>
 #include <X11/extensions/Xinerama.h>
-#include <sys/time.h>
+#include <sys/timerfd.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 
 #include "path_utils.h"
+#include "scan_utils.h"
+#include "history_utils.h"
+#include "trace_utils.h"
+#include "daemon_utils.h"
+#include "launch_utils.h"
+#include "lines_utils.h"
+#include "complete_utils.h"
 #include "draw_utils.h"
 #include "config.h"
 
 int debug = 0;  // Global debug flag
+#ifdef ENABLE_FUZZY
+int fuzzy = 1;  // Match suggestions as a subsequence instead of a prefix
+#else
+int fuzzy = 0;
+#endif
+int daemon_mode = 0;  // Stay resident with the window unmapped between uses
+int lines_mode = 0;   // Pick one of the lines on stdin and print it, like dmenu
+int vertical_lines = VERTICAL_LINES;  // Rows of suggestions under the input, 0 to list them beside it
 
 // Helper function to print debug info
 void debug_print(const char *msg) {
     if (debug) {
         printf("DEBUG: %s\n", msg);
     }
+    trace_message(msg);
 }
 
 // Function to convert hex color to XRenderColor
@@ -32,27 +51,179 @@ XRenderColor hex_to_xrendercolor(unsigned int hex) {
     };
 }
 
+// (Re)start the one-shot inactivity deadline
+void arm_inactivity_timer(int timer_fd) {
+    struct itimerspec deadline = {0};
+    deadline.it_value.tv_sec = TIMEOUT_SECONDS;
+    timerfd_settime(timer_fd, 0, &deadline, NULL);
+}
+
+// Put the window away but keep everything else around for the next DAEMON_SHOW
+void hide_menu(Display *display, Window window, int timer_fd) {
+    struct itimerspec disarm = {0};
+    timerfd_settime(timer_fd, 0, &disarm, NULL);
+    XUnmapWindow(display, window);
+    XFlush(display);
+}
+
+// Fill result_list for the input: from the stdin lines when there are some,
+// with file paths once the input has arguments, from $PATH otherwise.
+// Returns -1 with result_list unchanged if cancel (may be NULL) stopped the search for newer input.
+int search_input(const ExecIndex *index, SearchState *search_state, LineInput *lines, PathCompleter *completer,
+                 SearchCancel *cancel, const char *input, ResultList *result_list) {
+    uint64_t search_start = trace_begin();
+    ResultList previous = *result_list;
+    int count;
+    if (lines) {
+        count = lines_search(lines, search_state->fuzzy, input, result_list, cancel);
+    } else if (strchr(input, ' ')) {
+        count = complete_path(completer, input, result_list);
+    } else {
+        search_state->cancel = cancel;
+        count = search_binaries(index, search_state, input, result_list);
+    }
+    if (count < 0) {
+        *result_list = previous;
+    }
+    trace_end(TRACE_SEARCH, search_start);
+    return count;
+}
+
+// Fetch the page of the current results starting at rank offset, once search_input has run for input
+void page_input(const ExecIndex *index, SearchState *search_state, LineInput *lines, PathCompleter *completer,
+                const char *input, int offset, ResultList *result_list) {
+    if (lines) {
+        lines_page(lines, offset, result_list);
+    } else if (strchr(input, ' ')) {
+        complete_page(completer, input, offset, result_list);
+    } else {
+        search_page(index, search_state, offset, result_list);
+    }
+}
+
+// Select the result of rank row, turning to the page it is on when it isn't shown. Moving towards the end
+// of a row of suggestions starts the next page with it; moving towards the start ends the previous page on
+// it, and a vertical list scrolls the other way round. Either way at most two pages are fetched.
+void select_result(Display *display, XftFont *font, MenuLayout *layout, const ExecIndex *index, SearchState *search_state,
+                   LineInput *lines, PathCompleter *completer, const char *input, ResultList *result_list, int row, int forward) {
+    int visible = layout_visible(display, font, input, result_list, layout);
+    if (row >= result_list->offset && row < result_list->offset + visible) {
+        result_list->selected = row - result_list->offset;
+        return;
+    }
+    if (forward == (layout->rows == 0)) {
+        page_input(index, search_state, lines, completer, input, row, result_list);
+    } else {
+        // Whatever fits before and including row
+        int first = row - MAX_RESULTS + 1 > 0 ? row - MAX_RESULTS + 1 : 0;
+        page_input(index, search_state, lines, completer, input, first, result_list);
+        if (row - result_list->offset + 1 < result_list->count) {
+            result_list->count = row - result_list->offset + 1;
+        }
+        int fit = layout_fit_back(display, font, layout, input, result_list);
+        page_input(index, search_state, lines, completer, input, row - fit + 1, result_list);
+    }
+    result_list->selected = row - result_list->offset;
+}
+
+// Refresh the launch history bonus, needed whenever the index gains entries
+void rank_by_history(History *history, const ExecIndex *index, SearchState *search_state) {
+    search_state->boost = history_rank(history, index);
+    search_state->boost_count = search_state->boost ? index->id_count : 0;
+}
+
 int main(int argc, char *argv[]) {
     // Parse command-line arguments for the -d (debug) flag
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-d") == 0) {
             debug = 1;
             printf("Debug mode enabled.\n");
+        } else if (strcmp(argv[i], "-f") == 0) {
+            fuzzy = 1;
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            // Record key-to-pixel spans and write them as Chrome trace JSON on exit
+            if (trace_start(argv[++i]) != 0) {
+                fprintf(stderr, "Unable to start tracing\n");
+            }
+        } else if (strcmp(argv[i], "-s") == 0) {
+            lines_mode = 1;
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            // List suggestions vertically in this many rows
+            vertical_lines = atoi(argv[++i]);
+            if (vertical_lines < 0) {
+                vertical_lines = 0;
+            } else if (vertical_lines > MAX_RESULTS) {
+                vertical_lines = MAX_RESULTS;
+            }
+        } else if (strcmp(argv[i], "-D") == 0) {
+            daemon_mode = 1;
+        } else if (strcmp(argv[i], "-q") == 0) {
+            // Stop the resident instance
+            return daemon_notify(DAEMON_QUIT) == 0 ? 0 : 1;
+        }
+    }
+
+    // With an instance already resident, all this invocation has to do is ask it to show
+    if (!lines_mode && daemon_notify(DAEMON_SHOW) == 0) {
+        debug_print("Resident instance asked to show.");
+        return 0;
+    }
+
+    // In stdin mode the lines are the candidates, $PATH and the launch history aren't needed
+    LineInput lines;
+    LineInput *line_input = NULL;
+    if (lines_mode) {
+        if (lines_open(&lines, STDIN_FILENO) != 0) {
+            perror("Unable to read stdin");
+            exit(1);
         }
+        line_input = &lines;
+        daemon_mode = 0;
     }
 
+    int listen_fd = -1;
+    if (daemon_mode) {
+        listen_fd = daemon_listen();
+        if (listen_fd < 0) {
+            perror("Unable to listen on the daemon socket");
+            exit(1);
+        }
+        // Launched commands are never waited for, let the kernel reap them
+        signal(SIGCHLD, SIG_IGN);
+    }
+
+    // Start scanning $PATH right away, the workers run while the window is being set up
+    ExecIndex exec_index = {0};
+    SearchState search_state = {0};
+    search_state.fuzzy = fuzzy;
+    PathScanner scanner = { .wake_fd = -1, .watch_fd = -1 };
+    if (!line_input) {
+        scanner_start(&scanner, &exec_index);
+    }
+
+    PathCompleter completer;
+    completer_init(&completer);
+
+    History history = {0};
+#ifdef ENABLE_HISTORY
+    if (!line_input) {
+        history_open(&history);
+    }
+#endif
+    rank_by_history(&history, &exec_index, &search_state);
+
     Display *display;
     Window window;
     XEvent event;
     int screen;
     GC gc;
     XftFont *font;
-    XftDraw *draw;
     XftColor input_xft_color, suggestion_xft_color;
 
     display = XOpenDisplay(NULL);
     if (display == NULL) {
         fprintf(stderr, "Cannot open display\n");
+        scanner_free(&scanner);
         exit(1);
     }
 
@@ -60,7 +231,7 @@ int main(int argc, char *argv[]) {
 
     screen = DefaultScreen(display);
     int screen_width = DisplayWidth(display, screen);
-    int window_height = FONT_SIZE + TOP_PADDING + BOTTOM_PADDING;
+    int window_height = (FONT_SIZE + TOP_PADDING + BOTTOM_PADDING) * (vertical_lines + 1);
 
     // Use the WINDOW_BG_COLOR defined in config.h for the window background
     unsigned long bg_pixel = WINDOW_BG_COLOR; 
@@ -101,13 +272,18 @@ int main(int argc, char *argv[]) {
 
     XSetWindowAttributes attributes;
     attributes.override_redirect = True;
-    attributes.event_mask = ExposureMask | KeyPressMask | StructureNotifyMask;
+    attributes.event_mask = ExposureMask | KeyPressMask | StructureNotifyMask | FocusChangeMask;
     XChangeWindowAttributes(display, window, CWOverrideRedirect | CWEventMask, &attributes);
-    XMapWindow(display, window);
+    int visible = !daemon_mode;
+    if (visible) {
+        XMapWindow(display, window);
+    }
 
-    debug_print("Window created and mapped.");
+    debug_print("Window created.");
 
-    gc = XCreateGC(display, window, 0, NULL);
+    // No NoExpose events after every XCopyArea, they would only wake the loop and cancel searches
+    XGCValues gc_values = { .graphics_exposures = False };
+    gc = XCreateGC(display, window, GCGraphicsExposures, &gc_values);
 
     // Initialize XftColor for input text color
     XRenderColor render_color = hex_to_xrendercolor(INPUT_TEXT_COLOR);
@@ -117,9 +293,6 @@ int main(int argc, char *argv[]) {
     XRenderColor suggestion_render_color = hex_to_xrendercolor(SUGGESTION_TEXT_COLOR);
     XftColorAllocValue(display, DefaultVisual(display, screen), DefaultColormap(display, screen), &suggestion_render_color, &suggestion_xft_color);
 
-    // Create an XftDraw object for drawing the font
-    draw = XftDrawCreate(display, window, DefaultVisual(display, screen), DefaultColormap(display, screen));
-
     // Define the desired font with size included in the font name
     char font_desc[256];
     snprintf(font_desc, sizeof(font_desc), "%s:pixelsize=%d", CUSTOM_FONT, FONT_SIZE);  // Set the desired size
@@ -128,60 +301,119 @@ int main(int argc, char *argv[]) {
     font = XftFontOpenName(display, screen, font_desc);
     if (!font) {
         fprintf(stderr, "Unable to load font: %s\n", font_desc);
+        scanner_free(&scanner);
         exit(1);
     }
 
     debug_print("Font loaded and applied.");
 
+    MenuLayout layout;
+    layout_init(&layout, display, window, vertical_lines, line_input != NULL);
+
     char input[MAX_INPUT_LENGTH] = {0};
     int input_len = 0;
     ResultList result_list = {0};
     result_list.selected = -1;  // Initialize selected index to -1
 
-    ensure_window_focus(display, window);
-    debug_print("Window focus ensured.");
-
-    struct timeval last_event_time, current_time;
-    gettimeofday(&last_event_time, NULL);
-
-    while (1) {
-        gettimeofday(&current_time, NULL);
-        long elapsed_time = current_time.tv_sec - last_event_time.tv_sec;
-
-        if (elapsed_time >= TIMEOUT_SECONDS) {
-            printf("Exiting due to inactivity timeout.\n");
-            break;
-        }
+    // Sleep in poll() on the X connection and the inactivity timer instead of spinning
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (visible) {
+        ensure_window_focus(display, window);
+        debug_print("Window focus ensured.");
+        arm_inactivity_timer(timer_fd);
+    }
 
-        if (XPending(display) > 0) {
+    // A mapped stdin always polls readable, so it is split a chunk at a time between X events
+    struct pollfd fds[7] = {
+        { .fd = ConnectionNumber(display), .events = POLLIN },
+        { .fd = timer_fd, .events = POLLIN },
+        { .fd = scanner_done(&scanner) ? -1 : scanner.wake_fd, .events = POLLIN },
+        { .fd = listen_fd, .events = POLLIN },
+        { .fd = line_input ? lines.fd : -1, .events = POLLIN },
+        { .fd = scanner_done(&scanner) ? scanner.watch_fd : -1, .events = POLLIN },
+        { .fd = completer.wake_fd, .events = POLLIN },
+    };
+    int running = 1;
+    int exit_status = line_input ? 1 : 0;  // dmenu exits with 1 when nothing was picked
+    int hide_requested = 0;
+
+    // Keys only edit the input; it is searched and drawn once per drained batch of events, so a burst
+    // of typing or a paste costs one search. Anything arriving on the X connection meanwhile cancels it.
+    SearchCancel search_cancel = { .fd = ConnectionNumber(display) };
+    int search_pending = 0;
+    int input_edited = 0;  // The pending search is for new input rather than new candidates
+    int redraw = 0;
+    uint64_t key_start = 0;  // First KeyPress of the batch not on screen yet, 0 if none or tracing is off
+
+    while (running) {
+        // Handle everything Xlib has already read before going back to sleep
+        while (running && XPending(display) > 0) {
             XNextEvent(display, &event);
+            uint64_t event_start = trace_begin();
+
+            if (event.type == FocusOut && visible) {
+                // Something took the focus away, take it back
+                ensure_window_focus(display, window);
+                debug_print("Focus lost, focus grabbed again.");
+            }
 
-            if (event.type == Expose) {
-                // Redraw the menu with current input and suggestions
-                XClearWindow(display, window);
-                draw_menu(display, window, gc, input, &result_list, font, draw, &input_xft_color, &suggestion_xft_color);
+            if (event.type == Expose && event.xexpose.count == 0) {
+                // Put the last frame back, or draw the first one
+                if (layout.drawn) {
+                    present_menu(display, window, gc, &layout);
+                } else {
+                    draw_menu(display, window, gc, input, &result_list, font, &input_xft_color, &suggestion_xft_color, &layout);
+                }
                 debug_print("Expose event triggered.");
             }
 
             if (event.type == KeyPress) {
-                gettimeofday(&last_event_time, NULL);  // Reset the inactivity timer on key press
+                if (!key_start) {
+                    key_start = trace_begin();
+                }
+                arm_inactivity_timer(timer_fd);  // Reset the inactivity timer on key press
                 KeySym key;
                 char buffer[10];
                 int len = XLookupString(&event.xkey, buffer, sizeof(buffer), &key, NULL);
 
+                // Keys acting on the suggestions need them for everything typed before them in this batch
+                int moves = key == XK_Left || key == XK_Right || key == XK_Up || key == XK_Down ||
+                            key == XK_Prior || key == XK_Next;
+                if (search_pending && (key == XK_Return || key == XK_Tab || moves)) {
+                    search_input(&exec_index, &search_state, line_input, &completer, NULL, input, &result_list);
+                    search_pending = 0;
+                }
+
                 if (key == XK_Return) {
                     debug_print("Return key pressed.");
-                    if (input_len > 0) {
-                        char *binary = NULL;
+                    if (line_input) {
+                        // Print the selected line in full, or the input when nothing matched
+                        if (result_list.selected >= 0 && result_list.selected < result_list.count) {
+                            int line = result_list.ids[result_list.selected];
+                            fwrite(lines_text(&lines, line), 1, lines_len(&lines, line), stdout);
+                            putchar('\n');
+                        } else {
+                            printf("%s\n", input);
+                        }
+                        exit_status = 0;
+                        running = 0;
+                        break;
+                    } else if (input_len > 0) {
+                        const char *binary = NULL;
                         char *args = NULL;
+                        int id = -1;  // Index entry of the binary when a suggestion supplies it
 
-                        // Split input into binary and arguments using first space as separator
-                        binary = strtok(input, " ");
+                        // Split a copy of the input into binary and arguments using first space as separator,
+                        // the input itself stays as typed in case the launch fails
+                        char typed[MAX_INPUT_LENGTH];
+                        memcpy(typed, input, sizeof(typed));
+                        binary = strtok(typed, " ");
                         args = strtok(NULL, "");  // Get the rest of the input as arguments
 
-                        if (result_list.selected >= 0 && result_list.selected < result_list.count) {
-                            // If a suggestion is selected, use it as the binary
+                        if (result_list.selected >= 0 && result_list.selected < result_list.count && result_list.ids[result_list.selected] >= 0) {
+                            // If a suggestion is selected, use it as the binary (path completions are left alone)
                             binary = result_list.items[result_list.selected];
+                            id = result_list.ids[result_list.selected];
                         }
 
                         if (binary && strlen(binary) > 0) {
@@ -193,92 +425,244 @@ int main(int argc, char *argv[]) {
                             }
 
                             printf("Executing: %s\n", cmd);
-                            debug_print("Forking to execute command.");
-
-                            pid_t pid = fork();
-                            if (pid == 0) {
-                                // In child process: Execute the command via shell
-                                execlp("/bin/sh", "sh", "-c", cmd, (char *)NULL);
-                                perror("execlp failed");
-                                free(cmd);
-                                exit(1);
-                            } else if (pid > 0) {
-                                free(cmd);
+                            debug_print("Spawning command.");
+
+                            int launched = launch_command(&exec_index, id, cmd) == 0;
+                            free(cmd);
+
+                            if (!launched) {
+                                // Keep the window up with the input untouched so the command can be corrected
+                                debug_print("Launch failed.");
+                            } else if (daemon_mode) {
+                                history_record(&history, binary);
+                                // Stay resident, the window is hidden before the next poll()
+                                hide_requested = 1;
+                            } else {
+                                history_record(&history, binary);
 
                                 // Clean up and exit
-                                for (int i = 0; i < result_list.count; i++) {
-                                    free(result_list.items[i]);
-                                }
+                                search_free(&search_state);
+                                history_close(&history);
+                                scanner_free(&scanner);
+                                index_free(&exec_index);
                                 XFreeGC(display, gc);
                                 XDestroyWindow(display, window);
                                 XCloseDisplay(display);
                                 exit(0);
-                            } else {
-                                perror("fork failed");
                             }
                         }
                     }
                 } else if (key == XK_Escape) {
-                    debug_print("Escape key pressed. Exiting.");
-                    break;  // Exit on escape
+                    if (daemon_mode) {
+                        debug_print("Escape key pressed. Hiding.");
+                        hide_requested = 1;
+                    } else {
+                        debug_print("Escape key pressed. Exiting.");
+                        running = 0;  // Exit on escape
+                        break;
+                    }
                 } else if (key == XK_Tab) {
                     debug_print("Tab key pressed for autocomplete.");
-                    if (result_list.count > 0) {
-                        strncpy(input, result_list.items[0], MAX_INPUT_LENGTH - 1);
+                    int choice = result_list.selected > 0 && result_list.selected < result_list.count ? result_list.selected : 0;
+                    if (result_list.count > 0 && result_list.ids[choice] < 0) {
+                        // A path completion only replaces the part of the argument being typed
+                        input_len = complete_apply(input, MAX_INPUT_LENGTH, result_list.items[choice]);
+                        search_pending = input_edited = 1;
+                    } else if (result_list.count > 0) {
+                        strncpy(input, result_list.items[choice], MAX_INPUT_LENGTH - 1);
                         input[MAX_INPUT_LENGTH - 1] = '\0';
                         input_len = strlen(input);
+                        search_pending = input_edited = 1;
                     }
                 } else if (key == XK_BackSpace) {
                     if (input_len > 0) {
                         input[--input_len] = '\0';
+                        search_pending = input_edited = 1;
                         debug_print("Backspace key pressed.");
                     }
                 } else if (len > 0 && input_len < MAX_INPUT_LENGTH - 1) {
                     input[input_len++] = buffer[0];
                     input[input_len] = '\0';
+                    search_pending = input_edited = 1;
                     debug_print("Character entered.");
-                } else if (key == XK_Right) {
-    debug_print("Right arrow key pressed.");
-    if (result_list.count > 0) {
-        // Move selection to the next suggestion
-        result_list.selected = (result_list.selected + 1) % result_list.count;
-        debug_print(result_list.items[result_list.selected]); // Print currently selected suggestion
-    }
-} else if (key == XK_Left) {
-    debug_print("Left arrow key pressed.");
-    if (result_list.count > 0) {
-        // Move selection to the previous suggestion
-        result_list.selected = (result_list.selected - 1 + result_list.count) % result_list.count;
-        debug_print(result_list.items[result_list.selected]); // Print currently selected suggestion
-    }
-}
-
-                // Reset suggestion list if there is a space
-                char *first_space = strchr(input, ' ');
-                if (first_space) {
-                    result_list.count = 0;  // No suggestions after the first argument
+                } else if (moves && result_list.total > 0) {
+                    debug_print("Selection moved.");
+                    // Arrows step through every result and wrap around, Page Up/Down move a screenful
+                    int total = result_list.total;
+                    int row = result_list.offset + result_list.selected;
+                    int forward = key == XK_Right || key == XK_Down || key == XK_Next;
+                    if (key == XK_Prior || key == XK_Next) {
+                        int page = layout_visible(display, font, input, &result_list, &layout);
+                        page = page > 0 ? page : 1;
+                        row += forward ? page : -page;
+                        row = row < 0 ? 0 : row >= total ? total - 1 : row;
+                    } else {
+                        row = ((forward ? row + 1 : row - 1) % total + total) % total;
+                    }
+                    select_result(display, font, &layout, &exec_index, &search_state, line_input, &completer,
+                                  input, &result_list, row, forward);
+                    debug_print(result_list.items[result_list.selected]); // Print currently selected suggestion
                 }
 
-                // Perform a search for binaries matching the current input
-                search_binaries(input, &result_list);
+                // Searched and drawn after the rest of the batch has been applied
+                redraw = 1;
+            }
+            trace_end(TRACE_EVENT, event_start);
+        }
+        if (!running) {
+            break;
+        }
+
+        if (hide_requested) {
+            // Clear the input and draw the empty frame now, so showing again is only a map
+            hide_menu(display, window, timer_fd);
+            visible = 0;
+            hide_requested = 0;
+            input[0] = '\0';
+            input_len = 0;
+            result_list.selected = -1;
+            search_reset(&search_state);
+            rank_by_history(&history, &exec_index, &search_state);
+            search_input(&exec_index, &search_state, line_input, &completer, NULL, input, &result_list);
+            draw_menu(display, window, gc, input, &result_list, font, &input_xft_color, &suggestion_xft_color, &layout);
+            search_pending = 0;
+            input_edited = 0;
+            redraw = 0;
+            key_start = 0;
+            debug_print("Window hidden.");
+        }
+
+        if (search_pending) {
+            // One search for the whole batch; the selection stays put when the suggestions do
+            ResultList previous = result_list;
+            if (search_input(&exec_index, &search_state, line_input, &completer, &search_cancel, input, &result_list) < 0) {
+                debug_print("Search dropped for newer input.");
+                continue;
+            }
+            search_pending = 0;
+            if (!input_edited && previous.offset > 0) {
+                // Fresh candidates for the same input, stay on the page being looked at
+                page_input(&exec_index, &search_state, line_input, &completer, input, previous.offset, &result_list);
+            }
+            input_edited = 0;
+            if (!results_equal(&previous, &result_list)) {
+                redraw = 1;
+            } else {
+                result_list.selected = previous.selected;
+            }
+        }
+        if (redraw) {
+            draw_menu(display, window, gc, input, &result_list, font, &input_xft_color, &suggestion_xft_color, &layout);
+            redraw = 0;
+        }
+        if (key_start) {
+            // The batch's keys are on screen once draw_menu has flushed
+            trace_end(TRACE_KEY, key_start);
+            key_start = 0;
+        }
+
+        if (poll(fds, 7, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll failed");
+            break;
+        }
 
-                // Use draw_menu for redrawing the menu with updated input
-                XClearWindow(display, window);
-                draw_menu(display, window, gc, input, &result_list, font, draw, &input_xft_color, &suggestion_xft_color);
+        if (fds[1].revents & POLLIN) {
+            if (daemon_mode) {
+                debug_print("Hiding due to inactivity timeout.");
+                hide_requested = 1;
+                continue;
+            }
+            fprintf(line_input ? stderr : stdout, "Exiting due to inactivity timeout.\n");
+            break;
+        }
+        if (fds[0].revents & (POLLHUP | POLLERR)) {
+            fprintf(stderr, "Lost connection to the display\n");
+            break;
+        }
+
+        int index_changed = 0;
+        if ((fds[2].revents & POLLIN) && scanner_collect(&scanner, &exec_index) > 0) {
+            debug_print("Scanned directories merged into the index.");
+            index_changed = 1;
+            if (scanner_done(&scanner)) {
+                // Changes on disk can only be applied on top of a finished scan
+                fds[2].fd = -1;
+                fds[5].fd = scanner.watch_fd;
+            }
+        }
+        if ((fds[5].revents & POLLIN) && scanner_watch(&scanner, &exec_index) > 0) {
+            debug_print("$PATH directories changed, index updated.");
+            index_changed = 1;
+        }
+        if (!scanner_done(&scanner) && fds[2].fd < 0) {
+            // Directories are being read again, further changes wait for them like they did for the first scan
+            fds[2].fd = scanner.wake_fd;
+            fds[5].fd = -1;
+        }
+        if (index_changed) {
+            // Search and draw again on the next pass; ids may name other entries now, so nothing measured is kept
+            search_reset(&search_state);
+            rank_by_history(&history, &exec_index, &search_state);
+            layout_forget(&layout);
+            search_pending = 1;
+            redraw = 1;
+        }
+
+        if ((fds[6].revents & POLLIN) && completer_collect(&completer) > 0) {
+            // A directory listing arrived, it may complete the argument being typed
+            search_pending = 1;
+        }
+
+        if ((fds[4].revents & (POLLIN | POLLHUP)) && lines_read(&lines) > 0) {
+            // More lines came in, only they are filtered against the current input
+            search_pending = 1;
+        }
+        if (line_input && lines.eof) {
+            fds[4].fd = -1;
+        }
+
+        if (fds[3].revents & POLLIN) {
+            int command;
+            while ((command = daemon_receive(listen_fd)) >= 0) {
+                if (command == DAEMON_QUIT) {
+                    debug_print("Asked to quit.");
+                    running = 0;
+                } else if (command == DAEMON_SHOW && !visible) {
+                    // The frame is already drawn, mapping and focusing is all that's left
+                    uint64_t show_start = trace_begin();
+                    XMapRaised(display, window);
+                    ensure_window_focus(display, window);
+                    XFlush(display);
+                    arm_inactivity_timer(timer_fd);
+                    visible = 1;
+                    trace_end(TRACE_EVENT, show_start);
+                    debug_print("Window shown.");
+                }
             }
-        } else {
-            ensure_window_focus(display, window);
         }
     }
 
     // Cleanup
+    daemon_close(listen_fd);
+    completer_free(&completer);
+    close(timer_fd);
+    layout_free(&layout, display);
+    search_free(&search_state);
+    history_close(&history);
+    scanner_free(&scanner);
+    index_free(&exec_index);
+    if (line_input) {
+        lines_close(&lines);
+    }
     XftFontClose(display, font);
-    XftDrawDestroy(draw);
     XftColorFree(display, DefaultVisual(display, screen), DefaultColormap(display, screen), &input_xft_color);
     XftColorFree(display, DefaultVisual(display, screen), DefaultColormap(display, screen), &suggestion_xft_color);
     XFreeGC(display, gc);
     XDestroyWindow(display, window);
     XCloseDisplay(display);
 
-    return 0;
+    return exit_status;
 }
@@ -0,0 +1,306 @@
+#include "match_utils.h"
+
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Fuzzy scoring weights
+#define SCORE_MATCH 16              // Every matched character
+#define BONUS_START 24              // Match on the first character of the name
+#define BONUS_BOUNDARY 12           // Match right after '-', '_', '.' or '/'
+#define BONUS_CONSECUTIVE 8         // Match directly after the previous one
+#define PENALTY_GAP 2               // Per skipped character between matches, capped
+#define PENALTY_GAP_MAX 12
+#define PENALTY_LENGTH 1            // Per character of the name after the last match, capped
+#define PENALTY_LENGTH_MAX 15       // Below SCORE_MATCH, so a long name can't push a match under 0
+
+static inline char fold(char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static inline int is_boundary(char c) {
+    return c == '-' || c == '_' || c == '.' || c == '/';
+}
+
+// Bit per case-folded character class present in the first len bytes of s: a-z, 0-9, then everything else hashed
+uint64_t char_mask_n(const char *s, size_t len) {
+    uint64_t mask = 0;
+
+    for (const char *end = s + len; s < end; s++) {
+        char c = fold(*s);
+        if (c >= 'a' && c <= 'z') {
+            mask |= 1ULL << (c - 'a');
+        } else if (c >= '0' && c <= '9') {
+            mask |= 1ULL << (26 + c - '0');
+        } else {
+            mask |= 1ULL << (36 + (unsigned char)c % 28);
+        }
+    }
+    return mask;
+}
+
+uint64_t char_mask(const char *s) {
+    return char_mask_n(s, strlen(s));
+}
+
+// Find the first occurrence of the folded character lower (or its upper case form) before the NUL or newline,
+// so names can also be lines of a mapped file. Reads whole vectors past the end, the index and the
+// stdin lines keep INDEX_STRING_PAD readable bytes after the last name for this.
+static const char *find_folded(const char *s, char lower, char upper) {
+#if defined(__AVX2__)
+    const __m256i lo = _mm256_set1_epi8(lower), up = _mm256_set1_epi8(upper);
+    const __m256i zero = _mm256_setzero_si256(), newline = _mm256_set1_epi8('\n');
+    for (;; s += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)s);
+        uint32_t hits = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, lo), _mm256_cmpeq_epi8(v, up)));
+        uint32_t ends = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, zero), _mm256_cmpeq_epi8(v, newline)));
+        if (ends) {
+            hits &= (ends & -ends) - 1;
+            return hits ? s + __builtin_ctz(hits) : NULL;
+        }
+        if (hits) {
+            return s + __builtin_ctz(hits);
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i lo = _mm_set1_epi8(lower), up = _mm_set1_epi8(upper);
+    const __m128i zero = _mm_setzero_si128(), newline = _mm_set1_epi8('\n');
+    for (;; s += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)s);
+        uint32_t hits = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, lo), _mm_cmpeq_epi8(v, up)));
+        uint32_t ends = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, zero), _mm_cmpeq_epi8(v, newline)));
+        if (ends) {
+            hits &= (ends & -ends) - 1;
+            return hits ? s + __builtin_ctz(hits) : NULL;
+        }
+        if (hits) {
+            return s + __builtin_ctz(hits);
+        }
+    }
+#else
+    for (; *s && *s != '\n'; s++) {
+        if (*s == lower || *s == upper) {
+            return s;
+        }
+    }
+    return NULL;
+#endif
+}
+
+// Score name as a case-insensitive subsequence match of query, -1 if it doesn't match.
+// Each query character takes the leftmost occurrence after the previous one.
+int fuzzy_score(const char *name, int name_len, const char *query, int query_len) {
+    const char *p = name;
+    int score = 0;
+    int prev = -1;
+
+    for (int i = 0; i < query_len; i++) {
+        char lower = fold(query[i]);
+        char upper = (lower >= 'a' && lower <= 'z') ? lower - ('a' - 'A') : lower;
+        const char *hit = find_folded(p, lower, upper);
+        if (!hit) {
+            return -1;
+        }
+
+        int pos = hit - name;
+        score += SCORE_MATCH;
+        if (pos == 0) {
+            score += BONUS_START;
+        } else if (is_boundary(name[pos - 1])) {
+            score += BONUS_BOUNDARY;
+        }
+        if (prev >= 0 && pos == prev + 1) {
+            score += BONUS_CONSECUTIVE;
+        } else if (prev >= 0) {
+            int gap = (pos - prev - 1) * PENALTY_GAP;
+            score -= gap < PENALTY_GAP_MAX ? gap : PENALTY_GAP_MAX;
+        }
+        prev = pos;
+        p = hit + 1;
+    }
+
+    int tail = (name_len - prev - 1) * PENALTY_LENGTH;
+    return score - (tail < PENALTY_LENGTH_MAX ? tail : PENALTY_LENGTH_MAX);
+}
+
+static inline int heap_less(const ScoredMatch *a, const ScoredMatch *b) {
+    return a->score != b->score ? a->score < b->score : a->rank > b->rank;
+}
+
+static void heap_sift_down(MatchHeap *heap, int i) {
+    for (;;) {
+        int smallest = i, left = 2 * i + 1, right = left + 1;
+        if (left < heap->count && heap_less(&heap->items[left], &heap->items[smallest])) {
+            smallest = left;
+        }
+        if (right < heap->count && heap_less(&heap->items[right], &heap->items[smallest])) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        ScoredMatch tmp = heap->items[i];
+        heap->items[i] = heap->items[smallest];
+        heap->items[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+// Keep the match if it beats the worst of the current best MAX_RESULTS
+void heap_push(MatchHeap *heap, int id, int score, int rank) {
+    ScoredMatch match = { id, score, rank };
+
+    if (heap->count < MAX_RESULTS) {
+        int i = heap->count++;
+        heap->items[i] = match;
+        while (i > 0 && heap_less(&heap->items[i], &heap->items[(i - 1) / 2])) {
+            ScoredMatch tmp = heap->items[i];
+            heap->items[i] = heap->items[(i - 1) / 2];
+            heap->items[(i - 1) / 2] = tmp;
+            i = (i - 1) / 2;
+        }
+    } else if (heap_less(&heap->items[0], &match)) {
+        heap->items[0] = match;
+        heap_sift_down(heap, 0);
+    }
+}
+
+// Turn the heap into a list ordered best first
+void heap_sort(MatchHeap *heap) {
+    int count = heap->count;
+
+    while (heap->count > 1) {
+        ScoredMatch worst = heap->items[0];
+        heap->items[0] = heap->items[--heap->count];
+        heap->items[heap->count] = worst;
+        heap_sift_down(heap, 0);
+    }
+    heap->count = count;
+}
+
+static int match_compare(const void *a, const void *b) {
+    const ScoredMatch *x = a, *y = b;
+    if (x->score != y->score) {
+        return x->score > y->score ? -1 : 1;
+    }
+    return (x->rank > y->rank) - (x->rank < y->rank);
+}
+
+// Move the best k of matches to the front, in no particular order
+static void match_select(ScoredMatch *matches, int count, int k) {
+    int lo = 0, hi = count - 1;
+
+    while (lo < hi) {
+        ScoredMatch pivot = matches[lo + (hi - lo) / 2];
+        int i = lo, j = hi;
+        while (i <= j) {
+            while (match_compare(&matches[i], &pivot) < 0) {
+                i++;
+            }
+            while (match_compare(&matches[j], &pivot) > 0) {
+                j--;
+            }
+            if (i <= j) {
+                ScoredMatch tmp = matches[i];
+                matches[i++] = matches[j];
+                matches[j--] = tmp;
+            }
+        }
+        if (k - 1 <= j) {
+            hi = j;
+        } else if (k - 1 >= i) {
+            lo = i;
+        } else {
+            break;
+        }
+    }
+}
+
+// Order matches best first, the same way heap_sort orders the best MAX_RESULTS, but only as far as needed:
+// the first `sorted` already are, afterwards at least the first `want` are. Each call at least doubles how
+// far that goes, so scrolling deeper costs a few selections rather than sorting everything up front.
+// Returns how many are sorted now.
+int match_rank(ScoredMatch *matches, int count, int sorted, int want) {
+    if (want <= sorted) {
+        return sorted;
+    }
+    if (want < sorted * 2) {
+        want = sorted * 2;
+    }
+    if (want > count) {
+        want = count;
+    }
+    match_select(matches + sorted, count - sorted, want - sorted);
+    qsort(matches + sorted, want - sorted, sizeof(ScoredMatch), match_compare);
+    return want;
+}
+
+// Generation a search starting now runs under, 0 without a cancel
+unsigned search_generation(SearchCancel *cancel) {
+    return cancel ? atomic_load_explicit(&cancel->generation, memory_order_relaxed) : 0;
+}
+
+// Whether the search started at generation should stop. Safe to call from any of its threads.
+int search_cancelled(SearchCancel *cancel, unsigned generation) {
+    if (!cancel) {
+        return 0;
+    }
+    if (cancel->fd >= 0) {
+        struct pollfd pfd = { .fd = cancel->fd, .events = POLLIN };
+        if (poll(&pfd, 1, 0) > 0) {
+            atomic_fetch_add_explicit(&cancel->generation, 1, memory_order_relaxed);
+        }
+    }
+    return atomic_load_explicit(&cancel->generation, memory_order_relaxed) != generation;
+}
+
+// Score every candidate id against query, plus its history bonus if there is one. Matching ids are
+// written to matches in candidate order and the best ones are kept in heap. Returns the number of matches,
+// or -1 if cancel stopped it part way, with matches and heap only partly filled.
+int fuzzy_filter(const ExecIndex *index, const char *query, const int *candidates, int count, int *matches,
+                 const int *boost, int boost_count, MatchHeap *heap, SearchCancel *cancel) {
+    int query_len = strlen(query);
+    uint64_t query_mask = char_mask(query);
+    unsigned generation = search_generation(cancel);
+    int passed[SEARCH_CHECK_INTERVAL];
+    int matched = 0;
+
+    for (int start = 0; start < count; start += SEARCH_CHECK_INTERVAL) {
+        if (cancel && start > 0 && search_cancelled(cancel, generation)) {
+            return -1;
+        }
+        int end = count - start < SEARCH_CHECK_INTERVAL ? count : start + SEARCH_CHECK_INTERVAL;
+
+        // Cheap reject: the name lacks one of the query's characters altogether. Whether it does is close to
+        // a coin toss for a character like a digit, so the test is counted in rather than branched on.
+        int passed_count = 0;
+        for (int i = start; i < end; i++) {
+            passed[passed_count] = i;
+            passed_count += (query_mask & ~index->char_masks[candidates[i]]) == 0;
+        }
+
+        for (int p = 0; p < passed_count; p++) {
+            int i = passed[p];
+            int id = candidates[i];
+            const char *name = index_name(index, id);
+            int name_len = index_name_len(index, id);
+            int score = fuzzy_score(name, name_len, query, query_len);
+            if (score < 0) {
+                continue;
+            }
+            if (id < boost_count) {
+                score += boost[id];
+            }
+            matches[matched++] = id;
+            // Leave out the exact match, the input already shows it
+            if (name_len != query_len || strcmp(name, query) != 0) {
+                heap_push(heap, id, score, i);
+            }
+        }
+    }
+    return matched;
+}
@@ -0,0 +1,44 @@
+#ifndef MATCH_UTILS_H
+#define MATCH_UTILS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "index_utils.h"
+
+#define SEARCH_CHECK_INTERVAL 4096  // Candidates scored between two cancellation checks
+
+// Lets a long search give up once newer input is waiting. A search remembers the generation it started at
+// and stops at its next check after that has moved on; a check moves it on itself when fd turns readable.
+typedef struct {
+    atomic_uint generation;
+    int fd;                 // Readable once newer input is queued (the X connection), -1 to go by generation only
+} SearchCancel;
+
+// A candidate and how well it matched
+typedef struct {
+    int id;
+    int score;
+    int rank;               // Position among the candidates, breaks ties in sorted order
+} ScoredMatch;
+
+// Bounded min-heap holding the best MAX_RESULTS matches seen so far
+typedef struct {
+    ScoredMatch items[MAX_RESULTS];
+    int count;
+} MatchHeap;
+
+uint64_t char_mask(const char *s);
+uint64_t char_mask_n(const char *s, size_t len);
+int fuzzy_score(const char *name, int name_len, const char *query, int query_len);
+int fuzzy_filter(const ExecIndex *index, const char *query, const int *candidates, int count, int *matches,
+                 const int *boost, int boost_count, MatchHeap *heap, SearchCancel *cancel);
+unsigned search_generation(SearchCancel *cancel);
+int search_cancelled(SearchCancel *cancel, unsigned generation);
+void heap_push(MatchHeap *heap, int id, int score, int rank);
+void heap_sort(MatchHeap *heap);
+int match_rank(ScoredMatch *matches, int count, int sorted, int want);
+
+#endif
@@ -1,5 +1,6 @@
 #include "path_utils.h"
 #include "config.h"
+#include "match_utils.h"
 
 // Function implementations
 // Function to get paths from $PATH
@@ -20,11 +21,6 @@ char** get_path_dirs(int *count) {
     return dirs;
 }
 
-// Check if file is an executable
-int is_executable(const char *filepath) {
-    return access(filepath, X_OK) == 0;
-}
-
 int is_full_match(const char *input, ResultList *result_list) {
     for (int i = 0; i < result_list->count; i++) {
         if (strcmp(input, result_list->items[i]) == 0) {
@@ -34,62 +30,258 @@ int is_full_match(const char *input, ResultList *result_list) {
     return 0;  // No full match found
 }
 
-// Search for binary in directories
-int search_binaries(const char *query, ResultList *result_list) {
-    int dir_count = 0;
-    char **dirs = get_path_dirs(&dir_count);
-    struct dirent *entry;
-    char filepath[1024];
+// Check whether two result lists would be drawn the same
+int results_equal(const ResultList *a, const ResultList *b) {
+    return a->count == b->count && a->offset == b->offset && memcmp(a->ids, b->ids, sizeof(int) * a->count) == 0;
+}
+
+// Forget earlier queries, needed whenever the index or the match mode changes
+void search_reset(SearchState *state) {
+    state->query[0] = '\0';
+    state->depth = 0;
+    state->sets_used = 0;
+    state->ranked_valid = 0;
+}
+
+void search_free(SearchState *state) {
+    free(state->sets);
+    state->sets = NULL;
+    state->sets_cap = 0;
+    free(state->ranked);
+    state->ranked = NULL;
+    state->ranked_cap = 0;
+    search_reset(state);
+}
+
+// Pop the matches of queries that are no longer a prefix of the input.
+// Returns the matches of the longest earlier query the input still extends.
+static SearchRange *search_pop(const ExecIndex *index, SearchState *state, const char *query, int query_len) {
+    int common = 0;
+
+    while (common < query_len && state->query[common] == query[common]) {
+        common++;
+    }
+    memcpy(state->query, query, query_len + 1);
+
+    while (state->depth > 0 && state->stack[state->depth - 1].query_len > common) {
+        state->depth--;
+        if (state->fuzzy && state->depth > 0) {
+            state->sets_used = state->stack[state->depth].first;
+        }
+    }
+    if (state->depth == 0) {
+        state->stack[0] = (SearchRange){ 0, 0, index->count };
+        state->depth = 1;
+        state->sets_used = 0;
+    }
+    return &state->stack[state->depth - 1];
+}
+
+static SearchRange *search_push(SearchState *state, int query_len) {
+    SearchRange *next = &state->stack[state->depth++];
+    next->query_len = query_len;
+    return next;
+}
+
+// Narrow the previous prefix range to the block of entries starting with query
+static void search_prefix(const ExecIndex *index, SearchState *state, const char *query, int query_len) {
+    SearchRange *range = search_pop(index, state, query, query_len);
+
+    if (range->query_len < query_len && state->depth < MAX_INPUT_LENGTH) {
+        SearchRange *next = search_push(state, query_len);
+        next->first = range->first;
+        next->count = index_narrow_range(index, query, &next->first, range->count);
+        range = next;
+    }
+
+    // Without a launch history the range is already in ranked order, search_page slices it
+    state->top.count = 0;
+    if (!state->boost) {
+        return;
+    }
+
+    // With a launch history the most used matches go first, the rest stay in sorted order
+    for (int i = range->first; i < range->first + range->count; i++) {
+        int id = index->order[i];
+        if (index_name_len(index, id) != query_len || strcmp(query, index_name(index, id)) != 0) {
+            heap_push(&state->top, id, id < state->boost_count ? state->boost[id] : 0, i);
+        }
+    }
+    heap_sort(&state->top);
+}
+
+// Score the previous fuzzy match set against query and keep the best MAX_RESULTS.
+// The narrower set is stacked right after the one it came from, in memory reused from earlier keystrokes.
+// Returns -1 if state->cancel stopped it, leaving the stack as it would be for a shorter query.
+static int search_fuzzy(const ExecIndex *index, SearchState *state, const char *query, int query_len) {
+    SearchRange *base = search_pop(index, state, query, query_len);
+    MatchHeap heap = {0};
+
+    if (base->query_len == query_len) {
+        // Same query again: the set can't shrink, filtering in place just rebuilds the heap
+        int *ids = state->sets + base->first;
+        int count = fuzzy_filter(index, query, ids, base->count, ids, state->boost, state->boost_count, &heap, state->cancel);
+        if (count < 0) {
+            // Part of the set was overwritten, start over next time
+            search_reset(state);
+            return -1;
+        }
+        base->count = count;
+    } else {
+        if (state->sets_used + base->count > state->sets_cap) {
+            int cap = state->sets_cap ? state->sets_cap : 4096;
+            while (cap < state->sets_used + base->count) {
+                cap *= 2;
+            }
+            int *sets = realloc(state->sets, sizeof(int) * cap);
+            if (!sets) {
+                return 0;
+            }
+            state->sets = sets;
+            state->sets_cap = cap;
+        }
+
+        const int *candidates = base->query_len > 0 ? state->sets + base->first : index->order;
+        SearchRange *next = search_push(state, query_len);
+        next->first = state->sets_used;
+        next->count = fuzzy_filter(index, query, candidates, base->count, state->sets + next->first,
+                                   state->boost, state->boost_count, &heap, state->cancel);
+        if (next->count < 0) {
+            // The sets below are untouched, the next query narrows them instead
+            state->depth--;
+            return -1;
+        }
+        state->sets_used += next->count;
+    }
+
+    heap_sort(&heap);
+    state->top = heap;
+    return 0;
+}
+
+// Search the resident index for binaries matching query, by prefix or fuzzily, and fill in the first page.
+// Returns the number of results on it, or -1 when state->cancel stopped a fuzzy search for newer input.
+int search_binaries(const ExecIndex *index, SearchState *state, const char *query, ResultList *result_list) {
+    int query_len = strlen(query);
 
     result_list->count = 0;
     result_list->selected = 0;
+    result_list->offset = 0;
+    result_list->total = 0;
+    state->ranked_valid = 0;
+    if (query_len >= MAX_INPUT_LENGTH) {
+        return 0;
+    }
 
-    // Step 1: Search through PATH directories for matching binaries
-    for (int i = 0; i < dir_count; i++) {
-        DIR *dir = opendir(dirs[i]);
-        if (dir) {
-            while ((entry = readdir(dir)) != NULL) {
-                // Check if the binary starts with the query (prefix match)
-                if (strncmp(entry->d_name, query, strlen(query)) == 0) {
-                    snprintf(filepath, sizeof(filepath), "%s/%s", dirs[i], entry->d_name);
-                    if (is_executable(filepath)) {
-                        int is_duplicate = 0;
-                        // Avoid duplicates in the suggestion list
-                        for (int j = 0; j < result_list->count; j++) {
-                            if (strcmp(result_list->items[j], entry->d_name) == 0) {
-                                is_duplicate = 1;
-                                break;
-                            }
-                        }
-                        // Add to result list if it's not a duplicate and under the limit
-                        if (!is_duplicate && result_list->count < MAX_RESULTS) {
-                            result_list->items[result_list->count++] = strdup(entry->d_name);
-                        }
-                    }
-                }
-            }
-            closedir(dir);
+    // An empty query matches everything in either mode, the sorted order is the ranking
+    if (state->fuzzy && query_len > 0) {
+        if (search_fuzzy(index, state, query, query_len) < 0) {
+            return -1;
         }
+    } else {
+        search_prefix(index, state, query, query_len);
     }
+    return search_page(index, state, 0, result_list);
+}
 
-    // Step 2: Remove the exact match from the result list (if present)
-    for (int i = 0; i < result_list->count; i++) {
-        if (strcmp(query, result_list->items[i]) == 0) {
-            // Free the exact match and shift other suggestions up
-            free(result_list->items[i]);
-            for (int j = i; j < result_list->count - 1; j++) {
-                result_list->items[j] = result_list->items[j + 1];
-            }
-            result_list->count--;
-            break;
+// Whether the last query names an index entry exactly. That match is never listed, the input already shows it.
+// It sorts first among the entries it prefixes, so a prefix range starts with it.
+static int has_exact(const ExecIndex *index, const SearchState *state, const SearchRange *range, int scored) {
+    int first = range->first, count = range->count;
+    if (scored) {
+        count = index_prefix_range(index, state->query, &first);
+    }
+    return state->query[0] != '\0' && count > 0 && strcmp(index_name(index, index->order[first]), state->query) == 0;
+}
+
+// Score every match of the last query as the search scored it. Ties keep candidate order,
+// so once ranked they start with exactly the matches state->top holds.
+static int search_score(const ExecIndex *index, SearchState *state) {
+    const SearchRange *range = &state->stack[state->depth - 1];
+    const char *query = state->query;
+    int query_len = strlen(query);
+    int fuzzy = state->fuzzy && query_len > 0;
+    const int *ids = fuzzy ? state->sets + range->first : index->order + range->first;
+
+    if (range->count > state->ranked_cap) {
+        ScoredMatch *ranked = realloc(state->ranked, sizeof(ScoredMatch) * range->count);
+        if (!ranked) {
+            return -1;
         }
+        state->ranked = ranked;
+        state->ranked_cap = range->count;
     }
+    int count = 0;
+    for (int i = 0; i < range->count; i++) {
+        int id = ids[i];
+        const char *name = index_name(index, id);
+        int name_len = index_name_len(index, id);
+        if (name_len == query_len && strcmp(name, query) == 0) {
+            continue;
+        }
+        int score = fuzzy ? fuzzy_score(name, name_len, query, query_len) : 0;
+        if (id < state->boost_count) {
+            score += state->boost[id];
+        }
+        state->ranked[count++] = (ScoredMatch){ id, score, i };
+    }
+    state->ranked_count = count;
+    state->ranked_sorted = 0;
+    state->ranked_valid = 1;
+    return 0;
+}
 
-    // Step 3: Clean up
-    for (int i = 0; i < dir_count; i++) {
-        free(dirs[i]);
+// Fill result_list with the last query's results from rank offset on. Sorted prefix matches are a slice of the
+// index and the first page of scored ones was kept by the search. Past that every match is scored once per query
+// and only ranked as deep as the pages asked for, so paging back and forth costs no more than the rows shown.
+int search_page(const ExecIndex *index, SearchState *state, int offset, ResultList *result_list) {
+    result_list->count = 0;
+    result_list->selected = 0;
+    result_list->offset = 0;
+    result_list->total = 0;
+    if (state->depth == 0) {
+        return 0;
     }
-    free(dirs);
 
+    const SearchRange *range = &state->stack[state->depth - 1];
+    int scored = state->fuzzy && state->query[0] != '\0';
+    int exact = has_exact(index, state, range, scored);
+    int total = range->count - exact;
+    if (total <= 0) {
+        return 0;
+    }
+    if (offset > total - 1) {
+        offset = total - 1;
+    }
+    if (offset < 0) {
+        offset = 0;
+    }
+    result_list->offset = offset;
+    result_list->total = total;
+
+    if (!scored && !state->boost) {
+        // The exact match sorts first in its range
+        const int *ids = index->order + range->first + exact;
+        for (int i = offset; i < total && result_list->count < MAX_RESULTS; i++) {
+            result_list->ids[result_list->count] = ids[i];
+            result_list->items[result_list->count++] = index_name(index, ids[i]);
+        }
+        return result_list->count;
+    }
+
+    const ScoredMatch *matches = state->top.items;
+    int end = state->top.count;
+    if (offset > 0) {
+        if (!state->ranked_valid && search_score(index, state) != 0) {
+            return 0;
+        }
+        state->ranked_sorted = match_rank(state->ranked, state->ranked_count, state->ranked_sorted, offset + MAX_RESULTS);
+        matches = state->ranked;
+        end = state->ranked_sorted;
+    }
+    for (int i = offset; i < end && result_list->count < MAX_RESULTS; i++) {
+        result_list->ids[result_list->count] = matches[i].id;
+        result_list->items[result_list->count++] = index_name(index, matches[i].id);
+    }
     return result_list->count;
 }
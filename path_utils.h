@@ -9,16 +9,52 @@
 #include <ctype.h>
 
 #include "config.h"
+#include "index_utils.h"
+#include "match_utils.h"
 
+// One page of results. Items borrow the index's strings, they stay valid until the index changes.
 typedef struct {
     int count;
-    int selected;
-    char *items[MAX_RESULTS];
+    int selected;           // Within the page
+    int offset;             // Rank of items[0] among all results
+    int total;              // Results in all, other pages come from search_page() or lines_page()
+    const char *items[MAX_RESULTS];
+    int ids[MAX_RESULTS];   // Index entry each item came from, negative for path completions
 } ResultList;
 
+// Matches of one earlier query, the previous keystrokes form a stack of these
+typedef struct {
+    int query_len;
+    int first;              // Prefix mode: matches are order[first, first + count)
+    int count;              // Fuzzy mode: matches are sets[first, first + count)
+} SearchRange;
+
+// What the last query matched, so the next keystroke only narrows it
+typedef struct {
+    char query[MAX_INPUT_LENGTH];
+    SearchRange stack[MAX_INPUT_LENGTH];
+    int depth;
+    int *sets;              // Fuzzy match sets, stacked in the same order as stack
+    int sets_used;
+    int sets_cap;           // Only grows, so typing stops allocating once it has been reached
+    int fuzzy;              // Subsequence matching instead of prefix matching
+    const int *boost;       // boost[id] -> ranking bonus from the launch history, may be NULL
+    int boost_count;        // Ids covered by boost
+    SearchCancel *cancel;   // Lets newer input stop a fuzzy search part way, may be NULL
+    MatchHeap top;          // Best matches of the last query, sorted, when it is ranked by score
+    ScoredMatch *ranked;    // Every match of the last query, scored once a later page is asked for
+    int ranked_count;
+    int ranked_sorted;      // ranked[0, ranked_sorted) are the best, in order
+    int ranked_cap;
+    int ranked_valid;
+} SearchState;
+
 char** get_path_dirs(int *count);
-int is_executable(const char *filepath);
-int search_binaries(const char *query, ResultList *result_list);
+void search_reset(SearchState *state);
+void search_free(SearchState *state);
+int search_binaries(const ExecIndex *index, SearchState *state, const char *query, ResultList *result_list);
+int search_page(const ExecIndex *index, SearchState *state, int offset, ResultList *result_list);
 int is_full_match(const char *input, ResultList *result_list);
+int results_equal(const ResultList *a, const ResultList *b);
 
 #endif
@@ -0,0 +1,551 @@
+#define _GNU_SOURCE  // getdents64()
+
+#include "scan_utils.h"
+#include "cache_utils.h"
+#include "match_utils.h"
+#include "path_utils.h"
+#include "trace_utils.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+
+// Whether a directory entry is an executable file, using d_type to spend as few syscalls as possible
+static int entry_is_executable(int dir_fd, const char *name, unsigned char type) {
+    struct stat st;
+
+    switch (type) {
+    case DT_REG:
+        return faccessat(dir_fd, name, X_OK, 0) == 0;
+    case DT_LNK:
+    case DT_UNKNOWN:
+        // Follow the link, or find out what the entry is; directories would pass an X_OK check too
+        if (fstatat(dir_fd, name, &st, 0) != 0 || !S_ISREG(st.st_mode) || !(st.st_mode & 0111)) {
+            return 0;
+        }
+        // Executable for owner, group and others alike, nothing left for faccessat to decide
+        return (st.st_mode & 0111) == 0111 || faccessat(dir_fd, name, X_OK, 0) == 0;
+    default:
+        // Directories, sockets, fifos and devices
+        return 0;
+    }
+}
+
+// Collect the executables of one directory into a NUL-separated block.
+// Entries come in large getdents64 batches and are checked relative to the directory's fd,
+// so the kernel never walks the directory's path again.
+static void scan_dir_names(const char *path, ScanTask *task) {
+    char buf[SCAN_DENTS_SIZE] __attribute__((aligned(8)));
+    size_t cap = 0;
+    ssize_t got;
+
+    int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+        return;
+    }
+    while ((got = getdents64(dir_fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t pos = 0; pos < got;) {
+            const struct dirent64 *entry = (const struct dirent64 *)(buf + pos);
+            const char *name = entry->d_name;
+            pos += entry->d_reclen;
+
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            if (!entry_is_executable(dir_fd, name, entry->d_type)) {
+                continue;
+            }
+
+            size_t len = strlen(name) + 1;
+            if (task->names_len + len > cap) {
+                size_t new_cap = cap ? cap * 2 : 4096;
+                while (new_cap < task->names_len + len) {
+                    new_cap *= 2;
+                }
+                char *names = realloc(task->names, new_cap);
+                if (!names) {
+                    close(dir_fd);
+                    return;
+                }
+                task->names = names;
+                cap = new_cap;
+            }
+            memcpy(task->names + task->names_len, name, len);
+            task->names_len += len;
+        }
+    }
+    close(dir_fd);
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// Put a task's names in order and work out their character masks, so the main thread only has to
+// copy them in and merge. Without memory for it they stay as read and the main thread does the rest.
+static void sort_names(ScanTask *task) {
+    size_t count = 0;
+
+    for (size_t pos = 0; pos < task->names_len; pos += strlen(task->names + pos) + 1) {
+        count++;
+    }
+    const char **names = malloc(sizeof(char *) * (count ? count : 1));
+    char *sorted = malloc(task->names_len ? task->names_len : 1);
+    uint64_t *masks = malloc(sizeof(uint64_t) * (count ? count : 1));
+    if (!names || !sorted || !masks) {
+        free(names);
+        free(sorted);
+        free(masks);
+        return;
+    }
+
+    count = 0;
+    for (size_t pos = 0; pos < task->names_len; pos += strlen(task->names + pos) + 1) {
+        names[count++] = task->names + pos;
+    }
+    qsort(names, count, sizeof(char *), compare_names);
+    size_t len = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t size = strlen(names[i]) + 1;
+        memcpy(sorted + len, names[i], size);
+        masks[i] = char_mask_n(names[i], size - 1);
+        len += size;
+    }
+    free(names);
+    free(task->names);
+    task->names = sorted;
+    task->masks = masks;
+}
+
+// Worker loop: claim the next unscanned directory until none are left
+static void *scan_worker(void *arg) {
+    PathScanner *scanner = arg;
+    uint64_t one = 1;
+
+    for (;;) {
+        int i = atomic_fetch_add_explicit(&scanner->next_task, 1, memory_order_relaxed);
+        if (i >= scanner->task_count) {
+            break;
+        }
+        ScanTask *task = &scanner->tasks[i];
+        uint64_t scan_start = trace_begin();
+        scan_dir_names(scanner->index->dirs[task->dir].path, task);
+        sort_names(task);
+        trace_end(TRACE_SCAN_DIR, scan_start);
+        atomic_store_explicit(&task->done, 1, memory_order_release);
+        if (write(scanner->wake_fd, &one, sizeof(one)) < 0) {
+            // The main thread also picks finished tasks up in scanner_wait
+        }
+    }
+    return NULL;
+}
+
+// Largest directories first, so a huge /usr/bin doesn't start last and hold everyone up
+static int compare_tasks(const void *a, const void *b) {
+    off_t size_a = ((const ScanTask *)a)->dir_size, size_b = ((const ScanTask *)b)->dir_size;
+    return (size_a < size_b) - (size_a > size_b);
+}
+
+// Join the workers and write the cache back once every task has been merged
+static void scanner_finish(PathScanner *scanner, ExecIndex *index) {
+    for (int i = 0; i < scanner->thread_count; i++) {
+        pthread_join(scanner->threads[i], NULL);
+    }
+    scanner->thread_count = 0;
+
+#ifdef ENABLE_PATH_CACHE
+    if (scanner->stale) {
+        cache_write(index);
+        scanner->stale = 0;
+    }
+#else
+    (void)index;
+#endif
+}
+
+// Start workers for the tasks not handed out yet, pending of them
+static void scanner_spawn(PathScanner *scanner, int pending) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus > 0 && cpus < SCAN_THREADS ? (int)cpus : SCAN_THREADS;
+    if (threads > pending) {
+        threads = pending;
+    }
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&scanner->threads[scanner->thread_count], NULL, scan_worker, scanner) == 0) {
+            scanner->thread_count++;
+        }
+    }
+    // Couldn't start any threads, scan on this one instead
+    if (scanner->thread_count == 0) {
+        scan_worker(scanner);
+    }
+}
+
+// Record the mtime of dirs[dir], or -1 when it is missing or not a directory. Returns 1 if it is a directory.
+static int stat_dir(IndexDir *dir, struct stat *st) {
+    if (stat(dir->path, st) != 0 || !S_ISDIR(st->st_mode)) {
+        dir->mtime_sec = dir->mtime_nsec = -1;
+        return 0;
+    }
+    dir->mtime_sec = st->st_mtim.tv_sec;
+    dir->mtime_nsec = st->st_mtim.tv_nsec;
+    return 1;
+}
+
+// Remove a watch nothing refers to any more. $PATH entries can share one, as the directory itself
+// or as the ancestor of a missing entry.
+static void drop_watch(PathScanner *scanner, int wd) {
+    if (wd < 0) {
+        return;
+    }
+    for (int d = 0; d < scanner->index->dir_count; d++) {
+        if (scanner->watches[d] == wd || scanner->parent_watches[d] == wd) {
+            return;
+        }
+    }
+    inotify_rm_watch(scanner->watch_fd, wd);
+}
+
+// Watch dirs[dir] for mask, or while it is missing the closest ancestor that exists, so creating it shows up
+// as an event. Bits are only ever added to a watch, it may be shared. Returns 1 if the directory itself is watched now.
+static int watch_dir(PathScanner *scanner, int dir, uint32_t mask) {
+    const char *path = scanner->index->dirs[dir].path;
+    int old_parent = scanner->parent_watches[dir];
+    char parent[PATH_MAX];
+
+    // A second try once the ancestor is watched catches the directory appearing in between
+    for (int attempt = 0; attempt < 2; attempt++) {
+        scanner->watches[dir] = inotify_add_watch(scanner->watch_fd, path, mask | IN_MASK_ADD | IN_ONLYDIR);
+        if (scanner->watches[dir] >= 0) {
+            scanner->parent_watches[dir] = -1;
+            drop_watch(scanner, old_parent);
+            return 1;
+        }
+        if (attempt > 0 || snprintf(parent, sizeof(parent), "%s", path) >= (int)sizeof(parent)) {
+            break;
+        }
+
+        int wd = -1;
+        char *slash;
+        while (wd < 0 && (slash = strrchr(parent, '/'))) {
+            // Keep the slash of the root directory
+            slash[slash == parent] = '\0';
+            wd = inotify_add_watch(scanner->watch_fd, parent, SCAN_WATCH_MASK | IN_MASK_ADD | IN_ONLYDIR);
+            if (slash == parent) {
+                break;
+            }
+        }
+        scanner->parent_watches[dir] = wd;
+    }
+
+    if (old_parent != scanner->parent_watches[dir]) {
+        drop_watch(scanner, old_parent);
+    }
+    return 0;
+}
+
+// Add SCAN_ATTRIB_MASK to every directory watch, so a chmod +x is noticed. That takes milliseconds for a big
+// directory, and a chmod doesn't change the directory's mtime either, so the cache can't have caught it before.
+static void *watch_attrib(void *arg) {
+    PathScanner *scanner = arg;
+
+    for (int d = 0; d < scanner->index->dir_count; d++) {
+        inotify_add_watch(scanner->watch_fd, scanner->index->dirs[d].path, SCAN_ATTRIB_MASK | IN_MASK_ADD | IN_ONLYDIR);
+    }
+    return NULL;
+}
+
+// Fill the index from the on-disk cache and start workers for the directories it can't answer.
+// Returns the number of directories left to scan.
+int scanner_start(PathScanner *scanner, ExecIndex *index) {
+    int dir_count = 0;
+    char **dirs = get_path_dirs(&dir_count);
+    PathCache cache = {0};
+    struct stat st;
+
+    memset(scanner, 0, sizeof(*scanner));
+    scanner->index = index;
+    scanner->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    scanner->watch_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+
+#ifdef ENABLE_PATH_CACHE
+    scanner->stale = cache_open(&cache) != 0;
+#endif
+    // dir_map[cached dir] -> entry in index->dirs the cached names are still right for, -1 if none
+    int cached_count = cache.map ? (int)cache.header->dir_count : 0;
+    int *dir_map = malloc(sizeof(int) * (cached_count ? cached_count : 1));
+    for (int i = 0; dir_map && i < cached_count; i++) {
+        dir_map[i] = -1;
+    }
+    int unchanged = cache.map && dir_map;
+
+    index->dirs = calloc(dir_count, sizeof(IndexDir));
+    scanner->tasks = calloc(dir_count, sizeof(ScanTask));
+    scanner->watches = malloc(sizeof(int) * (dir_count ? dir_count : 1));
+    scanner->parent_watches = malloc(sizeof(int) * (dir_count ? dir_count : 1));
+    for (int i = 0; i < dir_count; i++) {
+        if (!index->dirs || !scanner->tasks || !scanner->watches || !scanner->parent_watches) {
+            free(dirs[i]);
+            continue;
+        }
+
+        int d = index->dir_count++;
+        IndexDir *dir = &index->dirs[d];
+        dir->path = dirs[i];
+        scanner->watches[d] = scanner->parent_watches[d] = -1;
+
+        // Watch before reading the cache or the directory, so no change can slip in between
+        if (scanner->watch_fd >= 0) {
+            watch_dir(scanner, d, SCAN_WATCH_MASK);
+        }
+        int exists = stat_dir(dir, &st);
+
+        // Missing directories are cached too, with no names and an mtime of -1
+        int cached = dir_map ? cache_find_dir(&cache, dir->path, d) : -1;
+        if (cached >= 0 && dir_map[cached] < 0 && cache.dirs[cached].mtime_sec == dir->mtime_sec &&
+            cache.dirs[cached].mtime_nsec == dir->mtime_nsec) {
+            dir_map[cached] = d;
+            unchanged &= cached == d;
+        } else if (exists) {
+            ScanTask *task = &scanner->tasks[scanner->task_count++];
+            task->dir = d;
+            task->dir_size = st.st_size;
+            scanner->stale = 1;
+            unchanged = 0;
+        } else {
+            scanner->stale = 1;
+            unchanged = 0;
+        }
+    }
+    free(dirs);
+
+    // Directories dropped from $PATH also make the cache out of date
+    if (cache.map && cache.header->dir_count != (uint32_t)index->dir_count) {
+        scanner->stale = 1;
+        unchanged = 0;
+    }
+    if (unchanged) {
+        // Nothing moved or changed, the cached index is used in place without reading a single name
+        cache_adopt_index(&cache, index);
+    } else if (cache.map && dir_map) {
+        // Take over what is still right, the sorted entries first and then the few copies they shadowed,
+        // so only those have to be sorted before they are merged in
+        ExecIndex cached;
+        cache_view_index(&cache, &cached);
+        index_add_entries(index, &cached, 0, cached.count, dir_map);
+        index_merge(index);
+        index_add_entries(index, &cached, cached.count, cached.id_count, dir_map);
+    }
+    free(dir_map);
+    cache_close(&cache);
+    index_merge(index);
+
+    if (scanner->watch_fd >= 0 && index->dir_count > 0) {
+        scanner->attrib_started = pthread_create(&scanner->attrib_thread, NULL, watch_attrib, scanner) == 0;
+    }
+
+    if (scanner->task_count == 0) {
+        index_finalize(index);
+        scanner_finish(scanner, index);
+        return 0;
+    }
+
+    qsort(scanner->tasks, scanner->task_count, sizeof(ScanTask), compare_tasks);
+    scanner_spawn(scanner, scanner->task_count);
+    return scanner->task_count;
+}
+
+// Merge every finished directory into the index. Returns the number of directories merged.
+int scanner_collect(PathScanner *scanner, ExecIndex *index) {
+    uint64_t merge_start = trace_begin();
+    uint64_t wakeups;
+    int merged = 0;
+
+    if (read(scanner->wake_fd, &wakeups, sizeof(wakeups)) < 0) {
+        // Nothing signalled yet, finished tasks are still picked up below
+    }
+
+    for (int i = 0; i < scanner->task_count; i++) {
+        ScanTask *task = &scanner->tasks[i];
+        if (task->merged || !atomic_load_explicit(&task->done, memory_order_acquire)) {
+            continue;
+        }
+
+        if (task->rescan) {
+            for (int id = 0; id < index->id_count; id++) {
+                if (index->dir_of[id] == task->dir) {
+                    index_remove(index, id);
+                }
+            }
+        }
+        index_add_names(index, task->names, task->names_len, task->masks, task->dir);
+        index_merge(index);
+
+        free(task->names);
+        free(task->masks);
+        task->names = NULL;
+        task->masks = NULL;
+        task->merged = 1;
+        scanner->merged_count++;
+        merged++;
+    }
+
+    // Ids stay put while directories come in, they are handed out in name order once the last one is merged
+    if (merged > 0) {
+        if (scanner_done(scanner)) {
+            index_finalize(index);
+            scanner_finish(scanner, index);
+        }
+        trace_end(TRACE_MERGE, merge_start);
+    }
+    return merged;
+}
+
+// Block until every directory has been scanned and merged
+void scanner_wait(PathScanner *scanner, ExecIndex *index) {
+    for (int i = 0; i < scanner->thread_count; i++) {
+        pthread_join(scanner->threads[i], NULL);
+    }
+    scanner->thread_count = 0;
+    scanner_collect(scanner, index);
+}
+
+int scanner_done(const PathScanner *scanner) {
+    return scanner->merged_count == scanner->task_count;
+}
+
+// Bring the entry for one name in dirs[dir] in line with what is on disk now, whatever the event was.
+// Returns 1 if the index changed.
+static int sync_entry(ExecIndex *index, int dir, const char *name) {
+    char path[PATH_MAX];
+
+    if (snprintf(path, sizeof(path), "%s/%s", index->dirs[dir].path, name) >= (int)sizeof(path)) {
+        return 0;
+    }
+    int executable = entry_is_executable(AT_FDCWD, path, DT_UNKNOWN);
+    int id = index_find(index, name, dir);
+    if (executable && id < 0) {
+        return index_add(index, name, dir) >= 0;
+    }
+    if (!executable && id >= 0) {
+        index_remove(index, id);
+        return 1;
+    }
+    return 0;
+}
+
+// Queue dirs[dir] to be read again from scratch, for when events were lost or the directory went away.
+// Its entries are replaced once scanner_collect merges the task. Returns -1 without memory for it.
+static int rescan_dir(PathScanner *scanner, int dir) {
+    for (int i = 0; i < scanner->task_count; i++) {
+        if (scanner->tasks[i].dir == dir) {
+            return 0;
+        }
+    }
+
+    // Every earlier task has been merged and its worker joined, so nothing else holds on to the array
+    ScanTask *tasks = realloc(scanner->tasks, sizeof(ScanTask) * (scanner->task_count + 1));
+    if (!tasks) {
+        return -1;
+    }
+    scanner->tasks = tasks;
+    ScanTask *task = &scanner->tasks[scanner->task_count++];
+    memset(task, 0, sizeof(*task));
+    task->dir = dir;
+    task->rescan = 1;
+    scanner->stale = 1;
+    return 0;
+}
+
+// Apply the changes inotify reported in the $PATH directories. Only call it once scanner_done(),
+// so nothing is applied ahead of the scan it happened after. Directories that have to be read again are
+// handed to the workers, scanner_done() is false until scanner_collect has merged them.
+// Returns the number of entries added or removed here.
+int scanner_watch(PathScanner *scanner, ExecIndex *index) {
+    char buf[SCAN_EVENTS_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    uint64_t watch_start = trace_begin();
+    struct stat st;
+    ssize_t got;
+    int changed = 0;
+
+    // Every task so far is merged, start a fresh list for the directories read again below
+    scanner->task_count = 0;
+    scanner->merged_count = 0;
+
+    while ((got = read(scanner->watch_fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t pos = 0; pos < got;) {
+            const struct inotify_event *event = (const struct inotify_event *)(buf + pos);
+            pos += sizeof(*event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                for (int d = 0; d < index->dir_count; d++) {
+                    rescan_dir(scanner, d);
+                }
+                continue;
+            }
+            // Two $PATH entries naming the same directory share one watch
+            for (int d = 0; d < index->dir_count; d++) {
+                if (scanner->parent_watches[d] == event->wd) {
+                    // Something was created on the way to a missing directory, or the ancestor itself went away
+                    if ((event->mask & (IN_CREATE | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)) &&
+                        watch_dir(scanner, d, SCAN_WATCH_MASK | SCAN_ATTRIB_MASK)) {
+                        stat_dir(&index->dirs[d], &st);
+                        rescan_dir(scanner, d);
+                    }
+                    continue;
+                }
+                if (scanner->watches[d] != event->wd) {
+                    continue;
+                }
+                if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                    // Its entries go, and whatever takes its place later is read again
+                    scanner->watches[d] = -1;
+                    drop_watch(scanner, event->wd);
+                    watch_dir(scanner, d, SCAN_WATCH_MASK | SCAN_ATTRIB_MASK);
+                    stat_dir(&index->dirs[d], &st);
+                    rescan_dir(scanner, d);
+                } else if (event->len > 0) {
+                    changed += sync_entry(index, d, event->name);
+                }
+            }
+        }
+    }
+
+    if (changed > 0) {
+        index_finalize(index);
+        trace_end(TRACE_MERGE, watch_start);
+    }
+    if (scanner->task_count > 0) {
+        atomic_store_explicit(&scanner->next_task, 0, memory_order_relaxed);
+        scanner_spawn(scanner, scanner->task_count);
+    }
+    return changed;
+}
+
+void scanner_free(PathScanner *scanner) {
+    // Let workers run out of directories before the tasks go away
+    atomic_store(&scanner->next_task, scanner->task_count);
+    for (int i = 0; i < scanner->thread_count; i++) {
+        pthread_join(scanner->threads[i], NULL);
+    }
+    if (scanner->attrib_started) {
+        pthread_join(scanner->attrib_thread, NULL);
+    }
+    for (int i = 0; i < scanner->task_count; i++) {
+        free(scanner->tasks[i].names);
+        free(scanner->tasks[i].masks);
+    }
+    free(scanner->tasks);
+    if (scanner->wake_fd >= 0) {
+        close(scanner->wake_fd);
+    }
+    if (scanner->watch_fd >= 0) {
+        close(scanner->watch_fd);
+    }
+    free(scanner->watches);
+    free(scanner->parent_watches);
+    memset(scanner, 0, sizeof(*scanner));
+}
@@ -0,0 +1,60 @@
+#ifndef SCAN_UTILS_H
+#define SCAN_UTILS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/inotify.h>
+#include <sys/types.h>
+
+#include "config.h"
+#include "index_utils.h"
+
+#define SCAN_DENTS_SIZE 65536       // Bytes of directory entries fetched per getdents64 call
+#define SCAN_EVENTS_SIZE 16384      // Bytes of inotify events read at a time
+#define SCAN_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+#define SCAN_ATTRIB_MASK IN_ATTRIB  // Added from a thread, the kernel visits every entry of the directory to set it up
+
+// One $PATH directory waiting to be scanned by a worker thread
+typedef struct {
+    int dir;                // Entry in ExecIndex.dirs
+    off_t dir_size;         // Size of the directory file, bigger ones are scanned first
+    char *names;            // NUL-separated executable names, sorted, owned by the worker until done
+    size_t names_len;
+    uint64_t *masks;        // char_mask() of each name once sorted, NULL leaves them to the main thread
+    atomic_int done;        // Set with release ordering once names is complete
+    int merged;             // Main thread only: names were added to the index
+    int rescan;             // Names replace what the index holds for dir instead of adding to it
+} ScanTask;
+
+// Scans the $PATH directories the cache couldn't answer on a pool of worker threads.
+// Workers only ever touch their own task, the main thread merges finished tasks into the index.
+// Every directory is watched with inotify from before it is read, so once the scan is done
+// scanner_watch keeps the index in step with installs and removals. Directories it has to read again
+// go back to the workers, and the scan is not done until they are merged too. A $PATH entry that doesn't
+// exist (yet) stays in the index without names, and its closest existing ancestor is watched until it appears.
+typedef struct {
+    ScanTask *tasks;
+    int task_count;
+    atomic_int next_task;   // Next task to hand out, idle workers claim it with fetch_add
+    int merged_count;
+    int stale;              // The on-disk cache needs to be rewritten
+    pthread_t threads[SCAN_THREADS];
+    int thread_count;
+    pthread_t attrib_thread;    // Adds SCAN_ATTRIB_MASK to the watches scanner_start set up
+    int attrib_started;
+    const ExecIndex *index;
+    int wake_fd;            // eventfd that becomes readable when a task finishes
+    int watch_fd;           // inotify instance watching the directories, -1 without one
+    int *watches;           // watches[dir] -> watch descriptor of index->dirs[dir], -1 if not watched
+    int *parent_watches;    // parent_watches[dir] -> watch on the closest ancestor while dirs[dir] is missing, else -1
+} PathScanner;
+
+int scanner_start(PathScanner *scanner, ExecIndex *index);
+int scanner_collect(PathScanner *scanner, ExecIndex *index);
+void scanner_wait(PathScanner *scanner, ExecIndex *index);
+int scanner_done(const PathScanner *scanner);
+int scanner_watch(PathScanner *scanner, ExecIndex *index);
+void scanner_free(PathScanner *scanner);
+
+#endif
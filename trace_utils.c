@@ -0,0 +1,155 @@
+#include "trace_utils.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+
+#define TRACE_MESSAGE_SIZE (64 * 1024)
+
+int trace_enabled = 0;
+
+static TraceRecord records[TRACE_CAPACITY];
+static atomic_uint_fast64_t next_record;    // Writers claim slots with fetch_add, the ring wraps around
+static char messages[TRACE_MESSAGE_SIZE];
+static atomic_uint next_message;
+static atomic_uint next_thread;
+static _Thread_local uint16_t thread_id;    // 0 until the thread records its first span
+static atomic_int writers;                  // Threads between trace_enter() and trace_leave()
+static atomic_int stopped;                  // Set by trace_dump(), nothing is written after it
+static char *trace_path;
+
+static const char *span_names[TRACE_SPAN_COUNT] = {
+    [TRACE_EVENT] = "event",
+    [TRACE_KEY] = "key",
+    [TRACE_SEARCH] = "search",
+    [TRACE_LAYOUT] = "layout",
+    [TRACE_DRAW] = "draw",
+    [TRACE_FLUSH] = "flush",
+    [TRACE_MERGE] = "merge",
+    [TRACE_SCAN_DIR] = "scan_dir",
+    [TRACE_MESSAGE] = "message",
+};
+
+uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// Announce a write to the ring, 0 once trace_dump() has started reading it. A thread that gets in
+// is waited for, so workers still running at exit never write under the dump.
+static int trace_enter(void) {
+    atomic_fetch_add(&writers, 1);
+    if (atomic_load(&stopped)) {
+        atomic_fetch_sub(&writers, 1);
+        return 0;
+    }
+    return 1;
+}
+
+static void trace_leave(void) {
+    atomic_fetch_sub_explicit(&writers, 1, memory_order_release);
+}
+
+static TraceRecord *trace_claim(TraceSpan span) {
+    if (thread_id == 0) {
+        thread_id = (uint16_t)(atomic_fetch_add_explicit(&next_thread, 1, memory_order_relaxed) + 1);
+    }
+    uint64_t slot = atomic_fetch_add_explicit(&next_record, 1, memory_order_relaxed);
+    TraceRecord *record = &records[slot & (TRACE_CAPACITY - 1)];
+    record->span = (uint16_t)span;
+    record->thread = thread_id;
+    return record;
+}
+
+void trace_record(TraceSpan span, uint64_t start_ns) {
+    uint64_t end_ns = trace_now();
+    if (!trace_enter()) {
+        return;
+    }
+    TraceRecord *record = trace_claim(span);
+
+    record->start_ns = start_ns;
+    record->duration_ns = end_ns - start_ns;
+    trace_leave();
+}
+
+// Keep debug_print() text in the trace as instant events
+void trace_message(const char *text) {
+    if (!trace_enabled || !trace_enter()) {
+        return;
+    }
+    size_t len = strlen(text) + 1;
+    unsigned offset = atomic_fetch_add_explicit(&next_message, (unsigned)len, memory_order_relaxed);
+    if (offset + len <= TRACE_MESSAGE_SIZE) {
+        memcpy(messages + offset, text, len);
+
+        TraceRecord *record = trace_claim(TRACE_MESSAGE);
+        record->start_ns = trace_now();
+        record->duration_ns = 0;
+        record->message = offset;
+    }
+    trace_leave();
+}
+
+// Write a JSON string, escaping what JSON requires
+static void write_json_string(FILE *file, const char *text) {
+    fputc('"', file);
+    for (; *text; text++) {
+        if (*text == '"' || *text == '\\') {
+            fprintf(file, "\\%c", *text);
+        } else if ((unsigned char)*text < 0x20) {
+            fprintf(file, "\\u%04x", *text);
+        } else {
+            fputc(*text, file);
+        }
+    }
+    fputc('"', file);
+}
+
+// Dump the ring as Chrome trace JSON (load it in chrome://tracing or Perfetto)
+static void trace_dump(void) {
+    // Shut writers out and wait for the ones already writing
+    atomic_store(&stopped, 1);
+    while (atomic_load_explicit(&writers, memory_order_acquire) > 0) {
+        sched_yield();
+    }
+
+    FILE *file = fopen(trace_path, "w");
+    if (!file) {
+        perror("Unable to write trace");
+        return;
+    }
+
+    uint64_t end = atomic_load(&next_record);
+    uint64_t start = end > TRACE_CAPACITY ? end - TRACE_CAPACITY : 0;
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (uint64_t i = start; i < end; i++) {
+        const TraceRecord *record = &records[i & (TRACE_CAPACITY - 1)];
+        fprintf(file, "%s{\"name\":", i > start ? ",\n" : "");
+        if (record->span == TRACE_MESSAGE) {
+            write_json_string(file, messages + record->message);
+            fprintf(file, ",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f", record->start_ns / 1000.0);
+        } else {
+            write_json_string(file, span_names[record->span]);
+            fprintf(file, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f", record->start_ns / 1000.0, record->duration_ns / 1000.0);
+        }
+        fprintf(file, ",\"pid\":1,\"tid\":%u}", record->thread);
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+}
+
+// Turn tracing on, the ring is written to path when the process exits
+int trace_start(const char *path) {
+    trace_path = strdup(path);
+    if (!trace_path || atexit(trace_dump) != 0) {
+        return -1;
+    }
+    trace_enabled = 1;
+    return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef TRACE_UTILS_H
+#define TRACE_UTILS_H
+
+#include <stdint.h>
+
+#define TRACE_CAPACITY 8192         // Spans kept, older ones are overwritten (power of two)
+
+// Spans recorded along the key-to-pixel path
+typedef enum {
+    TRACE_EVENT,            // Handling one X event
+    TRACE_KEY,              // First KeyPress of a batch until the batch's search is drawn and flushed
+    TRACE_SEARCH,
+    TRACE_LAYOUT,
+    TRACE_DRAW,
+    TRACE_FLUSH,
+    TRACE_MERGE,            // Merging scanned directories into the index
+    TRACE_SCAN_DIR,         // One directory on a worker thread
+    TRACE_MESSAGE,          // debug_print() text, as an instant event
+    TRACE_SPAN_COUNT
+} TraceSpan;
+
+typedef struct {
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    uint16_t span;
+    uint16_t thread;
+    uint32_t message;       // Offset into the message buffer for TRACE_MESSAGE
+} TraceRecord;
+
+extern int trace_enabled;
+
+int trace_start(const char *path);
+uint64_t trace_now(void);
+void trace_record(TraceSpan span, uint64_t start_ns);
+void trace_message(const char *text);
+
+// Start of a span, 0 when tracing is off
+static inline uint64_t trace_begin(void) {
+    return __builtin_expect(trace_enabled, 0) ? trace_now() : 0;
+}
+
+// End of a span started with trace_begin(), costs one predictable branch when tracing is off
+static inline void trace_end(TraceSpan span, uint64_t start_ns) {
+    if (__builtin_expect(trace_enabled, 0)) {
+        trace_record(span, start_ns);
+    }
+}
+
+#endif